@@ -10,6 +10,8 @@
 //    declarator follows,
 //      including one-liners like:  struct S { int x; int y; }  ->  struct S {
 //      int x; int y; };
+//    - Initializer bodies ("T t[] = { ... }") are one flat scope: nothing is
+//    inserted inside them, only the single ';' after the closing '}'.
 //
 // 3) Member access rewrite
 //    - Converts '.' to '->' when the base expression is a single pointer at the
@@ -33,21 +35,55 @@
 //    - For each input <path>.cp, writes a sibling <path>.cpp.
 //    - Spacing is preserved in a simple token-joined manner.
 //
-// Note: This program expects file paths as arguments (no stdin mode in this
-// build).
+// 7) Dialects
+//    - --dialect=full (default) runs every pass; --dialect=members only
+//    rewrites '.' to '->'; --dialect=semicolons only infers ';' (and accepts
+//    '->' in the input). Each is a separate instantiation of convert_source.
+//
+// Note: This program expects file paths as arguments. The exceptions are
+// --lsp, a language server on stdin/stdout, and --stream, which converts
+// stdin to stdout as the input arrives.
 
+#include <algorithm>
 #include <cctype>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
-#include <iostream>
+#include <iterator>
 #include <map>
+#include <new>
 #include <set>
-#include <sstream>
 #include <string>
 #include <vector>
 
+// Raw POSIX I/O keeps <iostream>/<fstream> (and their static init and locale
+// setup) out of the binary; other platforms fall back to <cstdio>.
+#if defined(__unix__) || defined(__APPLE__)
+#define CPLUS_POSIX 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#define CPLUS_INOTIFY 1
+#include <sys/inotify.h>
+#endif
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <ctime>
+#endif
+
 struct Token {
     enum Type {
         Identifier,
@@ -60,15 +96,103 @@ struct Token {
         Unknown
     } type;
     std::string text;
-    int line;
-    int col;
+    size_t pos;  // byte offset of the first character in the lexed text
     int scope_id;
-    Token() : type(Unknown), line(0), col(0), scope_id(0) {}
+    Token() : type(Unknown), pos(0), scope_id(0) {}
+};
+
+// A token belongs to the line of its last character (a string literal with
+// a raw newline sits on the line where it ends).
+static size_t token_last(const Token& t) {
+    return t.text.empty() ? t.pos : t.pos + t.text.size() - 1;
+}
+
+// Start offset of every line of a text, found with memchr (which the C
+// library vectorizes). Lines are 1-based; line and column are recovered by
+// binary search, only where a diagnostic or the line grouping needs them.
+struct LineIndex {
+    std::vector<size_t> starts;  // [line]; starts[0] is unused
+
+    void build(const std::string& s) {
+        starts.assign(2, 0);
+        const char* b = s.data();
+        const char* e = b + s.size();
+        for (const char* p = b;
+            (p = (const char*)std::memchr(p, '\n', e - p)) != 0;)
+            starts.push_back(++p - b);
+    }
+
+    int count() const { return (int)starts.size() - 1; }
+
+    int line_of(size_t pos) const {
+        return (int)(std::upper_bound(starts.begin() + 1, starts.end(), pos) -
+            starts.begin()) - 1;
+    }
+
+    int col_of(size_t pos) const {
+        return (int)(pos - starts[line_of(pos)]) + 1;
+    }
+};
+
+// C++98 has no move semantics: relocating a token swaps its text instead of
+// copying it, so long identifiers/directives are never reallocated.
+static void move_token(Token& dst, Token& src) {
+    dst.type = src.type;
+    dst.text.swap(src.text);
+    dst.pos = src.pos;
+    dst.scope_id = src.scope_id;
+}
+
+// Grow a token vector's storage by moving (not copying) its elements.
+static void grow_tokens(std::vector<Token>& v) {
+    std::vector<Token> bigger;
+    bigger.reserve(v.capacity() < 512 ? 1024 : v.capacity() * 2);
+    bigger.resize(v.size());
+    for (size_t i = 0; i < v.size(); ++i) move_token(bigger[i], v[i]);
+    v.swap(bigger);
+}
+
+// Append 'src' to 'v', leaving 'src' with empty text.
+static void append_moved(std::vector<Token>& v, Token& src) {
+    if (v.size() == v.capacity()) grow_tokens(v);
+    v.push_back(Token());
+    move_token(v.back(), src);
+}
+
+// A synthesized token placed at 'at' (shares its position, not its text).
+static Token synth_token(const Token& at, Token::Type type, const char* text) {
+    Token t;
+    t.type = type;
+    t.text = text;
+    t.pos = at.pos;
+    t.scope_id = at.scope_id;
+    return t;
+}
+
+// Compact record of one physical line, filled by the lexer as it emits
+// tokens (indexed by line number). Later passes may append a ';' or rewrite
+// '.', but never add or move the tokens these flags describe.
+struct LineSummary {
+    enum Flag {
+        Ctrl = 1,    // if / for / while / switch keyword
+        Assign = 2,  // '=' operator
+        LBrace = 4,  // '{'
+        RBrace = 8,  // '}'
+        Dot = 16     // '.' member access
+    };
+    unsigned char first_type;  // Token::Type of the first token
+    unsigned char last_type;   // Token::Type of the last token, as lexed
+    unsigned char flags;
+    size_t tok_begin, tok_end;  // token range [begin, end) in lex() output
+    LineSummary()
+        : first_type(Token::Unknown), last_type(Token::Unknown), flags(0),
+        tok_begin(0), tok_end(0) {}
 };
 
 struct Scope {
     int id, parent;
-    std::string kind;  // "Global","Function","Struct","Enum","Union","Block"
+    std::string kind;  // "Global","Function","Struct","Enum","Union","Block",
+                       // "Initializer"
     std::string name;
     Scope() : id(0), parent(-1) {}
 };
@@ -86,21 +210,568 @@ static bool isIdentChar(char c) {
     return std::isalnum((unsigned char)c) || c == '_';
 }
 
+// ----- allocation accounting -----
+// In a hooks build (-DCPLUS_ALLOC_HOOKS) global operator new/delete are
+// replaced so --mem-stats can follow live bytes and the check program's
+// --alloc-check can count heap traffic per phase. Counting is off unless a
+// mode turns it on; when off the cost is one predictable branch per
+// allocation (and per free). Other builds keep the C++ library's allocator,
+// and a host that #includes this file (CPLUS_NO_MAIN) must never have its
+// own replaced; check/cplus_check.cpp (CPLUS_CHECK_PROGRAM) is ours.
+#if defined(CPLUS_ALLOC_HOOKS) && defined(CPLUS_NO_MAIN) && \
+    !defined(CPLUS_CHECK_PROGRAM)
+#error "CPLUS_ALLOC_HOOKS would replace the host's global operator new"
+#endif
+#if __cplusplus >= 201103L
+#define CPLUS_THROW_BAD_ALLOC
+#define CPLUS_NOTHROW noexcept
+#else
+#define CPLUS_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define CPLUS_NOTHROW throw()
+#endif
+
+// Out-of-line deletes keep GCC from pairing an inlined free() with the
+// replaced operator new (-Wmismatched-new-delete false positive).
+#if defined(__GNUC__)
+#define CPLUS_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define CPLUS_NOINLINE __declspec(noinline)
+#else
+#define CPLUS_NOINLINE
+#endif
+
+struct AllocStats {
+    unsigned long long count;  // allocations
+    unsigned long long bytes;  // bytes requested
+    long long live;  // usable bytes allocated minus freed while tracking
+    long long peak;  // high-water mark of 'live' (reset per file)
+};
+static AllocStats g_alloc;  // zero-initialized: no static constructor
+static bool g_alloc_counting;
+static bool g_live_tracking;
+
+// Size of a live block as the C allocator sees it; without one, --mem-stats
+// reports bytes allocated but no live/peak figures.
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define CPLUS_ALLOC_SIZE(p) ::malloc_usable_size(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define CPLUS_ALLOC_SIZE(p) ::malloc_size(p)
+#elif defined(_WIN32)
+#include <malloc.h>
+#define CPLUS_ALLOC_SIZE(p) ::_msize(p)
+#endif
+
+#ifdef CPLUS_ALLOC_HOOKS
+#if defined(__GLIBC__)
+#define CPLUS_ALLOC_SITES 1
+#include <execinfo.h>
+// Call chains of counted allocations, kept in a fixed table so recording a
+// site never allocates.
+enum { kSiteDepth = 8, kSiteSlots = 1024 };
+struct AllocSite {
+    void* frames[kSiteDepth];
+    int depth;
+    unsigned long long count;
+};
+static AllocSite g_sites[kSiteSlots];
+static bool g_site_capture;
+static bool g_in_site_capture;
+
+static void record_alloc_site() {
+    if (g_in_site_capture) return;  // backtrace() may allocate once
+    g_in_site_capture = true;
+    void* fr[kSiteDepth + 1];
+    int n = ::backtrace(fr, kSiteDepth + 1) - 1;  // drop this frame
+    unsigned long h = 0;
+    for (int k = 0; k < n; ++k) h = h * 31 + (unsigned long)fr[k + 1];
+    for (int probe = 0; probe < kSiteSlots; ++probe) {
+        AllocSite& s = g_sites[(h + probe) % kSiteSlots];
+        if (s.count == 0) {
+            std::memcpy(s.frames, fr + 1, sizeof(void*) * n);
+            s.depth = n;
+        }
+        else if (s.depth != n ||
+            std::memcmp(s.frames, fr + 1, sizeof(void*) * n) != 0)
+            continue;
+        ++s.count;
+        break;
+    }
+    g_in_site_capture = false;
+}
+#endif
+
+static void* counted_alloc(std::size_t n) {
+    void* p = std::malloc(n ? n : 1);
+    if (g_alloc_counting && p) {
+        ++g_alloc.count;
+        g_alloc.bytes += n;
+#ifdef CPLUS_ALLOC_SITES
+        if (g_site_capture) record_alloc_site();
+#endif
+    }
+#ifdef CPLUS_ALLOC_SIZE
+    if (g_live_tracking && p) {
+        g_alloc.live += (long long)CPLUS_ALLOC_SIZE(p);
+        if (g_alloc.live > g_alloc.peak) g_alloc.peak = g_alloc.live;
+    }
+#endif
+    return p;
+}
+
+static void counted_free(void* p) {
+#ifdef CPLUS_ALLOC_SIZE
+    if (g_live_tracking && p) g_alloc.live -= (long long)CPLUS_ALLOC_SIZE(p);
+#endif
+    std::free(p);
+}
+
+void* operator new(std::size_t n) CPLUS_THROW_BAD_ALLOC {
+    void* p = counted_alloc(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](std::size_t n) CPLUS_THROW_BAD_ALLOC {
+    void* p = counted_alloc(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new(std::size_t n, const std::nothrow_t&) CPLUS_NOTHROW {
+    return counted_alloc(n);
+}
+void* operator new[](std::size_t n, const std::nothrow_t&) CPLUS_NOTHROW {
+    return counted_alloc(n);
+}
+CPLUS_NOINLINE void operator delete(void* p) CPLUS_NOTHROW { counted_free(p); }
+CPLUS_NOINLINE void operator delete[](void* p) CPLUS_NOTHROW {
+    counted_free(p);
+}
+CPLUS_NOINLINE void operator delete(void* p, const std::nothrow_t&)
+    CPLUS_NOTHROW {
+    counted_free(p);
+}
+CPLUS_NOINLINE void operator delete[](void* p, const std::nothrow_t&)
+    CPLUS_NOTHROW {
+    counted_free(p);
+}
+#if __cplusplus >= 201402L
+CPLUS_NOINLINE void operator delete(void* p, std::size_t) CPLUS_NOTHROW {
+    counted_free(p);
+}
+CPLUS_NOINLINE void operator delete[](void* p, std::size_t) CPLUS_NOTHROW {
+    counted_free(p);
+}
+#endif
+#endif  // CPLUS_ALLOC_HOOKS
+
+// ----- timing -----
+// Monotonic nanoseconds (only differences are meaningful).
+static double now_ns() {
+#ifdef CPLUS_POSIX
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#elif defined(_WIN32)
+    LARGE_INTEGER c, f;
+    ::QueryPerformanceCounter(&c);
+    ::QueryPerformanceFrequency(&f);
+    return (double)c.QuadPart * 1e9 / (double)f.QuadPart;
+#else
+    return (double)std::clock() * 1e9 / CLOCKS_PER_SEC;
+#endif
+}
+
+// ----- tracepoints -----
+// USDT probes (provider "cplus") for perf / bpftrace, built in with
+// -DCPLUS_USDT (needs <sys/sdt.h>); otherwise they compile to nothing and
+// their arguments are never evaluated. List them with
+//   bpftrace -l 'usdt:./cplus2cpp:cplus:*'
+//
+//   file__start(path)
+//   file__end(path, bytes_in, bytes_out, elapsed_ns)
+//   phase__start(phase)
+//   phase__end(phase, units, elapsed_ns)   units: bytes for read, preprocess
+//                                          and write; tokens for lex and
+//                                          analyze; lines for passes and
+//                                          rewrite/emit
+//   member__access(offset, ptr_level)      every '.' the rewrite examines:
+//                                          0 keeps '.', 1 writes '->', >1
+//                                          writes '(*x)->'
+//   semicolon__insert(offset, where)       0 end of line, 1 before '}',
+//                                          2 after a type block/initializer
+// Offsets are bytes into the input after CRLF and backslash-newline
+// folding.
+#ifdef CPLUS_USDT
+#include <sys/sdt.h>
+#define CPLUS_PROBE1(name, a) DTRACE_PROBE1(cplus, name, a)
+#define CPLUS_PROBE2(name, a, b) DTRACE_PROBE2(cplus, name, a, b)
+#define CPLUS_PROBE3(name, a, b, c) DTRACE_PROBE3(cplus, name, a, b, c)
+#define CPLUS_PROBE4(name, a, b, c, d) DTRACE_PROBE4(cplus, name, a, b, c, d)
+#define CPLUS_TRACE_CLOCK(var) double var = now_ns()
+#define CPLUS_TRACE_NS(var) ((long long)(now_ns() - (var)))
+#else
+#define CPLUS_PROBE1(name, a)
+#define CPLUS_PROBE2(name, a, b)
+#define CPLUS_PROBE3(name, a, b, c)
+#define CPLUS_PROBE4(name, a, b, c, d)
+#define CPLUS_TRACE_CLOCK(var)
+#define CPLUS_TRACE_NS(var)
+#endif
+
+// Peak resident set size of the process so far, in KiB (0 if unknown).
+static long peak_rss_kib() {
+#ifdef CPLUS_POSIX
+    struct rusage ru;
+    if (::getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return (long)(ru.ru_maxrss / 1024);  // bytes on macOS
+#else
+    return (long)ru.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// ----- profiling -----
+// Per-file phase times for --profile-report. The line-driven phases (lex,
+// analyze, rewrite/emit) also charge their time to fixed line ranges, sampled
+// only when a phase crosses into the next range. With --mem-stats each phase
+// also records the bytes it allocated and the live bytes it left behind.
+struct FileProfile {
+    enum Phase {
+        Read,
+        Preprocess,
+        Lex,
+        Analyze,
+        Passes,
+        Lines,
+        Write,
+        PhaseCount
+    };
+    enum { RangeLines = 64 };
+
+    std::string path;
+    double phase_ns[PhaseCount];
+    std::vector<double> range_ns;  // [range * PhaseCount + phase]
+
+    // memory, relative to the live bytes when the file was opened
+    size_t src_bytes;
+    unsigned long long alloc_bytes[PhaseCount];
+    long long live_after[PhaseCount];
+    long long peak_live;
+    long rss_kib;       // process RSS high-water mark after this file
+    long rss_grew_kib;  // how far this file raised it (0: an earlier file
+                        // had already used more)
+
+    const LineIndex* index;  // lines of the lexed text, for mark_pos()
+
+    FileProfile()
+        : src_bytes(0), peak_live(0), rss_kib(0), rss_grew_kib(0), index(0),
+        phase(Read),
+        start(0), last(0), range(0), next_mark(0), next_pos(0), base_live(0),
+        alloc_start(0) {
+        for (int p = 0; p < PhaseCount; ++p) {
+            phase_ns[p] = 0;
+            alloc_bytes[p] = 0;
+            live_after[p] = 0;
+        }
+    }
+
+    void open_file() {
+        base_live = g_alloc.live;
+        g_alloc.peak = g_alloc.live;
+        rss_kib = peak_rss_kib();
+    }
+    void close_file() {
+        peak_live = g_alloc.peak - base_live;
+        long before = rss_kib;
+        rss_kib = peak_rss_kib();
+        rss_grew_kib = rss_kib - before;
+    }
+
+    double total_ns() const {
+        double t = 0;
+        for (int p = 0; p < PhaseCount; ++p) t += phase_ns[p];
+        return t;
+    }
+
+    void begin(Phase p) {
+        phase = p;
+        alloc_start = g_alloc.bytes;
+        start = last = now_ns();
+        range = 0;
+        next_mark = RangeLines + 1;
+        next_pos = 0;
+    }
+    // The running phase has reached physical line 'line'.
+    void mark(int line) {
+        if (line < next_mark) return;
+        charge(now_ns());
+        range = (line - 1) / RangeLines;
+        next_mark = (range + 1) * RangeLines + 1;
+    }
+    // The same, by byte offset; looks the line up only at range crossings.
+    void mark_pos(size_t pos) {
+        if (pos < next_pos || !index) return;
+        mark(index->line_of(pos));
+        next_pos = next_mark <= index->count() ? index->starts[next_mark]
+                                               : (size_t)-1;
+    }
+    void end() {
+        double t = now_ns();
+        charge(t);
+        phase_ns[phase] += t - start;
+        alloc_bytes[phase] += g_alloc.bytes - alloc_start;
+        live_after[phase] = g_alloc.live - base_live;
+    }
+
+private:
+    Phase phase;
+    double start, last;
+    int range, next_mark;
+    size_t next_pos;
+    long long base_live;
+    unsigned long long alloc_start;
+
+    void charge(double t) {
+        if (phase == Lex || phase == Analyze || phase == Lines) {
+            size_t at = (size_t)range * PhaseCount + phase;
+            if (at >= range_ns.size())  // whole rows only
+                range_ns.resize((size_t)(range + 1) * PhaseCount, 0.0);
+            range_ns[at] += t - last;
+        }
+        last = t;
+    }
+};
+
+static const char* const kPhaseNames[FileProfile::PhaseCount] = {
+    "read", "preprocess", "lex", "analyze", "passes", "rewrite/emit", "write"
+};
+
+struct ProfileRange {
+    const FileProfile* file;
+    int range;
+    double ns;
+    int phase;
+};
+
+static bool slower_file(const FileProfile* a, const FileProfile* b) {
+    return a->total_ns() > b->total_ns();
+}
+static bool slower_range(const ProfileRange& a, const ProfileRange& b) {
+    return a.ns > b.ns;
+}
+
+// Top-N files by time, and within each the top-N line ranges with the phase
+// that spent the most time there.
+static void print_profile_report(const std::vector<FileProfile>& profs,
+    int top_n) {
+    std::vector<const FileProfile*> files;
+    double all = 0;
+    for (size_t i = 0; i < profs.size(); ++i) {
+        files.push_back(&profs[i]);
+        all += profs[i].total_ns();
+    }
+    std::sort(files.begin(), files.end(), slower_file);
+    if ((int)files.size() > top_n) files.resize(top_n);
+
+    std::fprintf(stderr, "profile: %d file(s), %.3f ms total\n",
+        (int)profs.size(), all / 1e6);
+    for (size_t f = 0; f < files.size(); ++f) {
+        const FileProfile& fp = *files[f];
+        double t = fp.total_ns();
+        std::fprintf(stderr, "%3d. %9.3f ms %5.1f%%  %s\n    ", (int)f + 1,
+            t / 1e6, all > 0 ? 100.0 * t / all : 0.0, fp.path.c_str());
+        for (int p = 0; p < FileProfile::PhaseCount; ++p)
+            std::fprintf(stderr, " %s %.3f", kPhaseNames[p],
+                fp.phase_ns[p] / 1e6);
+        std::fprintf(stderr, "\n");
+
+        std::vector<ProfileRange> ranges;
+        for (size_t at = 0; at < fp.range_ns.size();
+            at += FileProfile::PhaseCount) {
+            ProfileRange r;
+            r.file = &fp;
+            r.range = (int)(at / FileProfile::PhaseCount);
+            r.ns = 0;
+            r.phase = FileProfile::Lex;
+            for (int p = 0; p < FileProfile::PhaseCount; ++p) {
+                r.ns += fp.range_ns[at + p];
+                if (fp.range_ns[at + p] > fp.range_ns[at + r.phase])
+                    r.phase = p;
+            }
+            if (r.ns > 0) ranges.push_back(r);
+        }
+        std::sort(ranges.begin(), ranges.end(), slower_range);
+        for (size_t k = 0; k < ranges.size() && (int)k < top_n; ++k) {
+            const ProfileRange& r = ranges[k];
+            int first = r.range * FileProfile::RangeLines + 1;
+            std::fprintf(stderr, "      lines %d-%d: %.3f ms (%s)\n", first,
+                first + FileProfile::RangeLines - 1, r.ns / 1e6,
+                kPhaseNames[r.phase]);
+        }
+    }
+}
+
+// Per file: bytes allocated and live bytes left at the end of each phase,
+// the file's live high-water mark, the process RSS high-water mark so far
+// and how much the file raised it (getrusage has no per-file peak); then the
+// largest input's high-water mark on its own line for sizing.
+static void print_mem_report(const std::vector<FileProfile>& profs) {
+#ifdef CPLUS_ALLOC_SIZE
+    const bool live = true;
+#else
+    const bool live = false;
+#endif
+    const FileProfile* largest = 0;
+    for (size_t i = 0; i < profs.size(); ++i) {
+        const FileProfile& fp = profs[i];
+        if (!largest || fp.src_bytes > largest->src_bytes) largest = &fp;
+        std::fprintf(stderr,
+            "mem-stats: %s: %lu bytes in, peak live %lld, process peak RSS "
+            "so far %ld KiB (+%ld KiB)\n",
+            fp.path.c_str(), (unsigned long)fp.src_bytes,
+            live ? fp.peak_live : -1LL, fp.rss_kib, fp.rss_grew_kib);
+        for (int p = 0; p < FileProfile::PhaseCount; ++p)
+            std::fprintf(stderr,
+                "    %-12s allocated %12llu  live after %12lld\n",
+                kPhaseNames[p], fp.alloc_bytes[p],
+                live ? fp.live_after[p] : -1LL);
+    }
+    if (!largest) return;
+    std::fprintf(stderr,
+        "mem-stats: largest input %s (%lu bytes): high-water %lld bytes live "
+        "(%.1fx input), process peak RSS after it %ld KiB\n",
+        largest->path.c_str(), (unsigned long)largest->src_bytes,
+        live ? largest->peak_live : -1LL,
+        largest->src_bytes && live
+            ? (double)largest->peak_live / (double)largest->src_bytes
+            : 0.0,
+        largest->rss_kib);
+}
+
 static bool read_file(const char* path, std::string& out) {
-    std::ifstream in(path, std::ios::in | std::ios::binary);
-    if (!in) return false;
-    std::ostringstream ss;
-    ss << in.rdbuf();
-    out = ss.str();
+    out.clear();
+#ifdef CPLUS_POSIX
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) out.resize((size_t)st.st_size);
+    size_t got = 0;
+    char spill[4096];
+    for (;;) {
+        // read straight into the string; spill only past the fstat size
+        bool into_out = got < out.size();
+        char* dst = into_out ? &out[got] : spill;
+        size_t room = into_out ? out.size() - got : sizeof(spill);
+        ssize_t n = ::read(fd, dst, room);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            return false;
+        }
+        if (n == 0) break;
+        if (into_out)
+            got += (size_t)n;
+        else {
+            out.resize(got);
+            out.append(spill, (size_t)n);
+            got = out.size();
+        }
+    }
+    ::close(fd);
+    out.resize(got);
     return true;
+#else
+    std::FILE* f = std::fopen(path, "rb");
+    if (!f) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+    bool ok = !std::ferror(f);
+    std::fclose(f);
+    return ok;
+#endif
 }
 
 static bool write_text_file(const std::string& path, const std::string& data) {
-    std::ofstream out(path.c_str(),
-        std::ios::out | std::ios::binary | std::ios::trunc);
-    if (!out) return false;
-    out.write(data.data(), (std::streamsize)data.size());
-    return (bool)out;
+#ifdef CPLUS_POSIX
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return false;
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return ::close(fd) == 0;
+#else
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size();
+    return (std::fclose(f) == 0) && ok;
+#endif
+}
+
+// Compare 'data' with the file at 'path', reading only up to the first
+// difference. Returns 0 if they match, -1 if the file cannot be read, -2 if
+// the sizes differ (found without reading), else the 1-based line of 'data'
+// where they first differ.
+static long compare_text_file(const std::string& path,
+    const std::string& data) {
+    size_t done = 0;
+    bool differs = false;
+    char buf[65536];
+#ifdef CPLUS_POSIX
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && (size_t)st.st_size != data.size()) {
+        ::close(fd);
+        return -2;
+    }
+    for (;;) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ::close(fd);
+            return -1;
+        }
+#else
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) return -1;
+    for (;;) {
+        size_t n = std::fread(buf, 1, sizeof(buf), f);
+#endif
+        if (n == 0) {
+            differs = done < data.size();
+            break;
+        }
+        size_t m = std::min((size_t)n, data.size() - done);
+        size_t same = m;
+        if (std::memcmp(buf, data.data() + done, m) != 0)
+            for (same = 0; buf[same] == data[done + same];) ++same;
+        done += same;
+        if (same < (size_t)n) {  // a mismatch, or the file is longer
+            differs = true;
+            break;
+        }
+    }
+#ifdef CPLUS_POSIX
+    ::close(fd);
+#else
+    bool failed = std::ferror(f) != 0;
+    std::fclose(f);
+    if (failed) return -1;
+#endif
+    if (!differs) return 0;
+    return 1 + (long)std::count(data.begin(), data.begin() + done, '\n');
 }
 
 static std::string replace_ext(const std::string& path,
@@ -162,69 +833,397 @@ static bool is_punct_char(char c) {
         c == ']' || c == ';' || c == ',' || c == '.';
 }
 
-// ----- Lexer ('->' forbidden in C+ input) -----
-static void lex(const std::string& src, std::vector<Token>& out) {
+// Append a token (moved out of 't') and fold it into the summary of its
+// physical line.
+static void push_token(std::vector<Token>& out,
+    std::vector<LineSummary>& lines, Token& t, int line) {
+    if ((size_t)line >= lines.size()) lines.resize(line + 1);
+    LineSummary& ls = lines[line];
+    if (ls.tok_begin == ls.tok_end) {
+        ls.tok_begin = out.size();
+        ls.first_type = (unsigned char)t.type;
+    }
+    ls.tok_end = out.size() + 1;
+    ls.last_type = (unsigned char)t.type;
+    if (t.type == Token::Keyword) {
+        if (t.text == "if" || t.text == "for" || t.text == "while" ||
+            t.text == "switch")
+            ls.flags |= LineSummary::Ctrl;
+    }
+    else if (t.type == Token::Operator) {
+        if (t.text == "=") ls.flags |= LineSummary::Assign;
+    }
+    else if (t.type == Token::Punct) {
+        if (t.text == "{")
+            ls.flags |= LineSummary::LBrace;
+        else if (t.text == "}")
+            ls.flags |= LineSummary::RBrace;
+        else if (t.text == ".")
+            ls.flags |= LineSummary::Dot;
+    }
+    append_moved(out, t);
+}
+
+// ----- Lexer ('->' forbidden in C+ input unless forbid_arrow is off) -----
+// A forbidden '->' ends the process, unless an 'errors' sink is given: then
+// it is recorded there and lexed as an operator, so a host that must stay
+// up (the language server) can report it and keep converting.
+struct LexError {
+    int line, col;
+    const char* message;
+};
+
+// ----- conditional compilation -----
+// The lexer follows #if/#ifdef/#ifndef/#elif/#else/#endif. A branch that is
+// certainly not taken is skipped line by line (memchr) and kept as one
+// Preprocessor token holding its text verbatim, so it is emitted unchanged
+// and never analyzed or rewritten. Conditions are evaluated from -D/-U
+// only (macros #defined in the file are not followed): integers,
+// 'defined X', 'defined(X)', names given with -D (numeric value) or -U
+// (0), '!', '&&', '||' and parentheses. Anything else is unknown, and an
+// unknown branch is lexed like code, as are the branches after it unless a
+// certain one precedes them.
+struct MacroDefs {
+    std::map<std::string, std::string> defined;  // -DNAME[=VALUE]
+    std::set<std::string> undefined;             // -UNAME
+};
+static MacroDefs g_macros;
+
+enum CondValue { CondFalse, CondTrue, CondUnknown };
+
+enum CondDirective { NotCond, CondIf, CondIfdef, CondIfndef, CondElif,
+    CondElse, CondEndif };
+
+// Which conditional directive the line at 'p' (up to 'e') is; 'rest' is
+// set past the keyword.
+static CondDirective cond_directive(const char* p, const char* e,
+    const char*& rest) {
+    while (p < e && (*p == ' ' || *p == '\t')) ++p;
+    if (p == e || *p != '#') return NotCond;
+    for (++p; p < e && (*p == ' ' || *p == '\t');) ++p;
+    const char* k = p;
+    while (p < e && isIdentChar(*p)) ++p;
+    rest = p;
+    size_t len = p - k;
+    static const struct {
+        const char* word;
+        CondDirective d;
+    } kWords[] = { { "if", CondIf }, { "ifdef", CondIfdef },
+        { "ifndef", CondIfndef }, { "elif", CondElif }, { "else", CondElse },
+        { "endif", CondEndif } };
+    for (size_t w = 0; w < sizeof(kWords) / sizeof(kWords[0]); ++w)
+        if (std::strlen(kWords[w].word) == len &&
+            std::memcmp(k, kWords[w].word, len) == 0)
+            return kWords[w].d;
+    return NotCond;
+}
+
+// Recursive-descent evaluator over one directive's condition text.
+struct CondParser {
+    const char* p;
+    const char* e;
+    bool failed;  // something it does not understand: the result is unknown
+
+    CondParser(const char* b, const char* end) : p(b), e(end), failed(false) {}
+
+    void skip_space() {
+        while (p < e && (*p == ' ' || *p == '\t')) ++p;
+    }
+    bool eat(const char* s) {
+        skip_space();
+        size_t n = std::strlen(s);
+        if ((size_t)(e - p) < n || std::memcmp(p, s, n) != 0) return false;
+        p += n;
+        return true;
+    }
+    bool at_end() {
+        skip_space();
+        return p == e || (e - p >= 2 && p[0] == '/' &&
+                             (p[1] == '/' || p[1] == '*'));
+    }
+    // The identifier at 'p' as [b, p); sets 'failed' if there is none.
+    const char* ident() {
+        skip_space();
+        const char* b = p;
+        if (p < e && isIdentStart(*p))
+            while (p < e && isIdentChar(*p)) ++p;
+        if (b == p) failed = true;
+        return b;
+    }
+
+    // Conditions are evaluated on every lexed directive, so names are only
+    // copied into a std::string when there are -D/-U macros to look up.
+    static const std::string* lookup(const char* b, const char* end,
+        bool& undefined) {
+        undefined = false;
+        if (g_macros.defined.empty() && g_macros.undefined.empty()) return 0;
+        std::string name(b, end);
+        std::map<std::string, std::string>::const_iterator it =
+            g_macros.defined.find(name);
+        if (it != g_macros.defined.end()) return &it->second;
+        undefined = g_macros.undefined.count(name) != 0;
+        return 0;
+    }
+    static CondValue is_defined(const char* b, const char* end) {
+        bool undefined;
+        if (lookup(b, end, undefined)) return CondTrue;
+        return undefined ? CondFalse : CondUnknown;
+    }
+    static CondValue of_number(const char* b, const char* end) {
+        char buf[32];
+        if (b == end || (size_t)(end - b) >= sizeof(buf)) return CondUnknown;
+        std::memcpy(buf, b, end - b);
+        buf[end - b] = '\0';
+        char* stop = 0;
+        long v = std::strtol(buf, &stop, 0);
+        while (*stop == 'u' || *stop == 'U' || *stop == 'l' || *stop == 'L')
+            ++stop;
+        if (stop == buf || *stop) return CondUnknown;
+        return v ? CondTrue : CondFalse;
+    }
+
+    CondValue primary() {
+        skip_space();
+        if (eat("(")) {
+            CondValue v = disjunction();
+            if (!eat(")")) failed = true;
+            return v;
+        }
+        if (p < e && std::isdigit((unsigned char)*p)) {
+            const char* b = p;
+            while (p < e && isIdentChar(*p)) ++p;
+            return of_number(b, p);
+        }
+        const char* b = ident();
+        if (failed) return CondUnknown;
+        if (p - b == 7 && std::memcmp(b, "defined", 7) == 0) {
+            bool paren = eat("(");
+            b = ident();
+            const char* end = p;
+            if (paren && !eat(")")) failed = true;
+            return is_defined(b, end);
+        }
+        bool undefined;
+        const std::string* value = lookup(b, p, undefined);
+        if (value)
+            return value->empty()
+                ? CondTrue
+                : of_number(value->data(), value->data() + value->size());
+        return undefined ? CondFalse : CondUnknown;
+    }
+    CondValue unary() {
+        skip_space();
+        if (p < e && *p == '!' && !(p + 1 < e && p[1] == '=')) {
+            ++p;
+            CondValue v = unary();
+            return v == CondUnknown ? v : v == CondTrue ? CondFalse : CondTrue;
+        }
+        return primary();
+    }
+    CondValue conjunction() {
+        CondValue v = unary();
+        while (eat("&&")) {
+            CondValue w = unary();
+            if (v == CondFalse || w == CondFalse)
+                v = CondFalse;
+            else if (v == CondUnknown || w == CondUnknown)
+                v = CondUnknown;
+        }
+        return v;
+    }
+    CondValue disjunction() {
+        CondValue v = conjunction();
+        while (eat("||")) {
+            CondValue w = conjunction();
+            if (v == CondTrue || w == CondTrue)
+                v = CondTrue;
+            else if (v == CondUnknown || w == CondUnknown)
+                v = CondUnknown;
+        }
+        return v;
+    }
+};
+
+// Value of the condition of directive 'd' whose text after the keyword is
+// [p, e).
+static CondValue eval_condition(CondDirective d, const char* p,
+    const char* e) {
+    if (d == CondElse) return CondTrue;
+    CondParser cp(p, e);
+    CondValue v;
+    if (d == CondIfdef || d == CondIfndef) {
+        const char* b = cp.ident();
+        v = CondParser::is_defined(b, cp.p);
+        if (d == CondIfndef && v != CondUnknown)
+            v = v == CondTrue ? CondFalse : CondTrue;
+    }
+    else
+        v = cp.disjunction();
+    return cp.failed || !cp.at_end() ? CondUnknown : v;
+}
+
+// One #if group while the lexer is inside it.
+struct CondFrame {
+    bool taken;  // a branch was certainly taken: the rest are skipped
+    CondFrame() : taken(false) {}
+};
+
+// Update 'frames' for a directive the lexer reached; true if the text that
+// follows it is to be skipped.
+static bool enter_branch(std::vector<CondFrame>& frames, CondDirective d,
+    const char* rest, const char* e) {
+    if (d == CondEndif) {
+        if (!frames.empty()) frames.pop_back();
+        return false;
+    }
+    if (d == CondIf || d == CondIfdef || d == CondIfndef)
+        frames.push_back(CondFrame());
+    else if (frames.empty())
+        return false;  // stray #elif/#else
+    CondFrame& f = frames.back();
+    if (f.taken) return true;
+    CondValue v = eval_condition(d, rest, e);
+    if (v == CondFalse) return true;
+    if (v == CondTrue) f.taken = true;
+    return false;
+}
+
+// From 'p', a line start inside a skipped branch, find the start of the
+// #elif/#else/#endif line that ends it (nested groups skipped whole), or
+// 'e'.
+static const char* skip_branch(const char* p, const char* e) {
+    int depth = 0;
+    for (; p < e;) {
+        const char* eol = (const char*)std::memchr(p, '\n', e - p);
+        if (!eol) eol = e;
+        const char* rest;
+        switch (cond_directive(p, eol, rest)) {
+        case CondIf:
+        case CondIfdef:
+        case CondIfndef:
+            ++depth;
+            break;
+        case CondEndif:
+            if (depth == 0) return p;
+            --depth;
+            break;
+        case CondElif:
+        case CondElse:
+            if (depth == 0) return p;
+            break;
+        default:
+            break;
+        }
+        p = eol < e ? eol + 1 : e;
+    }
+    return e;
+}
+
+// 'spans', if given, receives every line that begins inside a block comment,
+// a string literal or a skipped #if branch (in increasing order). Tokens
+// record only their offset: the line counter moves at newlines and is used
+// just for the summaries.
+static void lex(const std::string& src, std::vector<Token>& out,
+    std::vector<LineSummary>& lines, bool forbid_arrow, FileProfile* prof,
+    std::vector<int>* spans = 0, std::vector<LexError>* errors = 0) {
     std::set<std::string> kw = make_keywords();
-    int line = 1, col = 1;
-    for (size_t i = 0; i < src.size();) {
+    std::vector<CondFrame> frames;
+    const size_t n = src.size();
+    int line = 1;
+    for (size_t i = 0; i < n;) {
         char c = src[i];
         if (c == '\n') {
             ++line;
-            col = 1;
             ++i;
+            if (prof) prof->mark(line);
             continue;
         }
         if (std::isspace((unsigned char)c)) {
             ++i;
-            ++col;
             continue;
         }
 
         if (c == '#') {  // preprocessor line
             size_t s = i;
-            int sc = col;
-            while (i < src.size() && src[i] != '\n') {
-                ++i;
-                ++col;
-            }
+            const char* nl =
+                (const char*)std::memchr(src.data() + i, '\n', n - i);
+            i = nl ? (size_t)(nl - src.data()) : n;
             Token t;
             t.type = Token::Preprocessor;
-            t.text = src.substr(s, i - s);
-            t.line = line;
-            t.col = sc;
-            out.push_back(t);
+            t.text.assign(src, s, i - s);
+            t.pos = s;
+            push_token(out, lines, t, line);
+
+            const char* rest;
+            CondDirective d =
+                cond_directive(src.data() + s, src.data() + i, rest);
+            if (d == NotCond || i == n ||
+                !enter_branch(frames, d, rest, src.data() + i))
+                continue;
+            // a skipped branch: its lines become one verbatim token
+            size_t b = i + 1;
+            size_t stop = skip_branch(src.data() + b, src.data() + n) -
+                src.data();
+            size_t end = stop > b && src[stop - 1] == '\n' ? stop - 1 : stop;
+            // a branch left open at EOF also holds the line after a final
+            // '\n', which the main loop counts
+            bool open_at_eof = stop == n && src[n - 1] == '\n';
+            if (end == b) {  // no text or one blank line: lexed as usual
+                if (spans && (b < stop || stop == n))
+                    spans->push_back(line + 1);
+                if (spans && b < stop && stop == n)
+                    spans->push_back(line + 2);
+                continue;
+            }
+            ++line;
+            if (spans) spans->push_back(line);
+            for (const char* q = src.data() + b;
+                (q = (const char*)std::memchr(q, '\n', src.data() + end - q));
+                ++q) {
+                ++line;
+                if (spans) spans->push_back(line);
+            }
+            t.type = Token::Preprocessor;
+            t.text.assign(src, b, end - b);
+            t.pos = b;
+            push_token(out, lines, t, line);
+            i = end;
+            if (open_at_eof && spans) spans->push_back(line + 1);
+            if (prof) prof->mark(line);
             continue;
         }
 
         // comments (drop)
-        if (c == '/' && i + 1 < src.size()) {
+        if (c == '/' && i + 1 < n) {
             if (src[i + 1] == '/') {
-                i += 2;
-                col += 2;
-                while (i < src.size() && src[i] != '\n') {
-                    ++i;
-                    ++col;
-                }
+                const char* nl =
+                    (const char*)std::memchr(src.data() + i, '\n', n - i);
+                i = nl ? (size_t)(nl - src.data()) : n;
                 continue;
             }
             if (src[i + 1] == '*') {
                 i += 2;
-                col += 2;
-                while (i + 1 < src.size()) {
+                bool closed = false;
+                while (i + 1 < n) {
                     if (src[i] == '\n') {
                         ++line;
-                        col = 1;
                         ++i;
+                        if (spans) spans->push_back(line);
                     }
                     else if (src[i] == '*' && src[i + 1] == '/') {
                         i += 2;
-                        col += 2;
+                        closed = true;
                         break;
                     }
-                    else {
+                    else
                         ++i;
-                        ++col;
-                    }
+                }
+                // left open at EOF: the line after a final '\n' is inside
+                if (!closed && i + 1 == n && src[i] == '\n') {
+                    ++line;
+                    ++i;
+                    if (spans) spans->push_back(line);
+                    if (prof) prof->mark(line);
                 }
                 continue;
             }
@@ -232,149 +1231,113 @@ static void lex(const std::string& src, std::vector<Token>& out) {
 
         if (c == '"') {  // string literal
             size_t s = i;
-            int sc = col;
             ++i;
-            ++col;
-            while (i < src.size()) {
+            while (i < n) {
                 char d = src[i];
-                if (d == '\\') {
-                    if (i + 1 < src.size()) {
-                        i += 2;
-                        col += 2;
-                    }
-                    else {
-                        ++i;
-                        ++col;
-                    }
-                }
+                if (d == '\\')
+                    i += i + 1 < n ? 2 : 1;
                 else if (d == '"') {
                     ++i;
-                    ++col;
                     break;
                 }
-                else if (d == '\n') {
-                    ++i;
-                    ++line;
-                    col = 1;
-                }
                 else {
+                    if (d == '\n') {
+                        ++line;
+                        if (spans) spans->push_back(line);
+                    }
                     ++i;
-                    ++col;
                 }
             }
             Token t;
             t.type = Token::StringLit;
-            t.text = src.substr(s, i - s);
-            t.line = line;
-            t.col = sc;
-            out.push_back(t);
+            t.text.assign(src, s, i - s);
+            t.pos = s;
+            push_token(out, lines, t, line);
             continue;
         }
 
         if (std::isdigit((unsigned char)c)) {  // number (simple)
             size_t s = i;
-            int sc = col;
             bool dot = false;
-            while (i < src.size()) {
+            while (i < n) {
                 char d = src[i];
-                if (std::isdigit((unsigned char)d)) {
+                if (std::isdigit((unsigned char)d))
                     ++i;
-                    ++col;
-                }
                 else if (d == '.' && !dot) {
                     dot = true;
                     ++i;
-                    ++col;
                 }
                 else
                     break;
             }
             Token t;
             t.type = Token::Number;
-            t.text = src.substr(s, i - s);
-            t.line = line;
-            t.col = sc;
-            out.push_back(t);
+            t.text.assign(src, s, i - s);
+            t.pos = s;
+            push_token(out, lines, t, line);
             continue;
         }
 
         if (isIdentStart(c)) {  // identifier / keyword
             size_t s = i;
-            int sc = col;
             ++i;
-            ++col;
-            while (i < src.size() && isIdentChar(src[i])) {
-                ++i;
-                ++col;
-            }
-            std::string w = src.substr(s, i - s);
+            while (i < n && isIdentChar(src[i])) ++i;
             Token t;
-            t.type = kw.count(w) ? Token::Keyword : Token::Identifier;
-            t.text = w;
-            t.line = line;
-            t.col = sc;
-            out.push_back(t);
+            t.text.assign(src, s, i - s);
+            t.type = kw.count(t.text) ? Token::Keyword : Token::Identifier;
+            t.pos = s;
+            push_token(out, lines, t, line);
             continue;
         }
 
         if (is_op_char(c)) {  // operators (two-char first) forbid '->'
-            int sc = col;
-            if (i + 1 < src.size()) {
+            if (i + 1 < n) {
                 std::string two = src.substr(i, 2);
-                if (two == "->") {
-                    std::fprintf(stderr,
-                        "C+ error: '->' is not allowed (line %d, col "
-                        "%d). Pointers use '.' in C+.\n",
-                        line, sc);
-                    std::exit(2);
+                if (two == "->" && forbid_arrow) {
+                    size_t bol = src.rfind('\n', i);
+                    bol = bol == std::string::npos ? 0 : bol + 1;
+                    LexError err;
+                    err.line = line;
+                    err.col = (int)(i - bol) + 1;
+                    err.message = "'->' is not allowed; pointers use '.' in C+";
+                    if (!errors) {
+                        std::fprintf(stderr,
+                            "C+ error: '->' is not allowed (line %d, col "
+                            "%d). Pointers use '.' in C+.\n",
+                            err.line, err.col);
+                        std::exit(2);
+                    }
+                    errors->push_back(err);
                 }
                 if (two == "++" || two == "--" || two == "==" || two == "!=" ||
                     two == ">=" || two == "<=" || two == "+=" || two == "-=" ||
                     two == "*=" || two == "/=" || two == "&&" || two == "||" ||
                     two == "&=" || two == "|=" || two == "^=" || two == "<<" ||
-                    two == ">>") {
+                    two == ">>" || two == "->") {
                     Token t;
                     t.type = Token::Operator;
                     t.text = two;
-                    t.line = line;
-                    t.col = sc;
-                    out.push_back(t);
+                    t.pos = i;
+                    push_token(out, lines, t, line);
                     i += 2;
-                    col += 2;
                     continue;
                 }
             }
             Token t;
             t.type = Token::Operator;
             t.text = std::string(1, c);
-            t.line = line;
-            t.col = sc;
-            out.push_back(t);
-            ++i;
-            ++col;
-            continue;
-        }
-
-        if (is_punct_char(c)) {
-            Token t;
-            t.type = Token::Punct;
-            t.text = std::string(1, c);
-            t.line = line;
-            t.col = col;
-            out.push_back(t);
+            t.pos = i;
+            push_token(out, lines, t, line);
             ++i;
-            ++col;
             continue;
         }
 
         Token t;
-        t.type = Token::Unknown;
+        t.type = is_punct_char(c) ? Token::Punct : Token::Unknown;
         t.text = std::string(1, c);
-        t.line = line;
-        t.col = col;
-        out.push_back(t);
+        t.pos = i;
+        push_token(out, lines, t, line);
         ++i;
-        ++col;
     }
 }
 
@@ -395,11 +1358,24 @@ static bool is_op(const std::vector<Token>& v, int i, const char* o) {
     return TKIs(v, i, Token::Operator, o);
 }
 
+static const char* const kBuiltinTypes[] = { "void",     "char",  "short",
+                                              "int",      "long",  "float",
+                                              "double",   "signed",
+                                              "unsigned", "bool" };
+
+// Allocation-free membership test (called per token by the analyzer).
+static bool is_builtin_type(const std::string& s) {
+    for (size_t i = 0; i < sizeof(kBuiltinTypes) / sizeof(kBuiltinTypes[0]);
+        ++i)
+        if (s == kBuiltinTypes[i]) return true;
+    return false;
+}
+
 static std::set<std::string> builtin_types() {
-    const char* bt[] = { "void",  "char",   "short",  "int",      "long",
-                        "float", "double", "signed", "unsigned", "bool" };
     std::set<std::string> s;
-    for (size_t i = 0; i < sizeof(bt) / sizeof(bt[0]); ++i) s.insert(bt[i]);
+    for (size_t i = 0; i < sizeof(kBuiltinTypes) / sizeof(kBuiltinTypes[0]);
+        ++i)
+        s.insert(kBuiltinTypes[i]);
     return s;
 }
 
@@ -462,7 +1438,7 @@ static void parse_params(const std::vector<Token>& tk, int lp, int rp,
             known_types.count(tk[i].text))
             type_start = true;
         if (i < rp && tk[i].type == Token::Keyword &&
-            (builtin_types().count(tk[i].text) || tk[i].text == "struct" ||
+            (is_builtin_type(tk[i].text) || tk[i].text == "struct" ||
                 tk[i].text == "enum" || tk[i].text == "union"))
             type_start = true;
         if (!type_start) {
@@ -570,44 +1546,134 @@ static bool detect_relaxed_declaration(const std::vector<Token>& tk, size_t i,
     return false;
 }
 
-// ---------- scope & decl analysis ----------
-static void analyze_scopes_and_vars(
-    std::vector<Token>& tk, std::vector<Scope>& scopes,
+// Index of the '}' matching the '{' at 'open' (tk.size() if unbalanced).
+static size_t find_matching_brace(const std::vector<Token>& tk, size_t open) {
+    int depth = 0;
+    for (size_t k = open; k < tk.size(); ++k) {
+        if (tk[k].type != Token::Punct) continue;
+        if (tk[k].text == "{")
+            ++depth;
+        else if (tk[k].text == "}" && --depth == 0)
+            return k;
+    }
+    return tk.size();
+}
+
+// Index of the type name that tk[i] declares, or -1: the last identifier
+// before ';' / '}' after a typedef, or the tag after struct/union/enum.
+// This does not depend on known_types, which is what lets a parallel batch
+// collect each file's names before converting any file.
+static int declared_type_name(const std::vector<Token>& tk, size_t i) {
+    if (is_kw(tk, (int)i, "typedef")) {
+        int last_ident = -1;
+        for (size_t j = i + 1;
+            j < tk.size() && !(tk[j].type == Token::Punct &&
+                (tk[j].text == ";" || tk[j].text == "}"));
+            ++j)
+            if (tk[j].type == Token::Identifier) last_ident = (int)j;
+        return last_ident;
+    }
+    if ((is_kw(tk, (int)i, "struct") || is_kw(tk, (int)i, "enum") ||
+            is_kw(tk, (int)i, "union")) &&
+        i + 1 < tk.size() && tk[i + 1].type == Token::Identifier)
+        return (int)i + 1;
+    return -1;
+}
+
+// Open a scope. The per-scope symbol maps are relocated by swapping rather
+// than copying when the table grows (C++98 vectors copy on regrowth).
+static void push_scope(std::vector<Scope>& scopes,
     std::vector<std::map<std::string, VarInfo> >& scope_vars,
-    std::set<std::string>& known_types) {
-    scopes.clear();
-    scope_vars.clear();
-    Scope g;
-    g.id = 0;
-    g.parent = -1;
-    g.kind = "Global";
-    g.name = "";
-    scopes.push_back(g);
+    const Scope& s) {
+    scopes.push_back(s);
+    if (scope_vars.size() == scope_vars.capacity()) {
+        std::vector<std::map<std::string, VarInfo> > bigger;
+        bigger.reserve(scope_vars.capacity() < 64 ? 128
+            : scope_vars.capacity() * 2);
+        bigger.resize(scope_vars.size());
+        for (size_t k = 0; k < scope_vars.size(); ++k)
+            bigger[k].swap(scope_vars[k]);
+        scope_vars.swap(bigger);
+    }
     scope_vars.push_back(std::map<std::string, VarInfo>());
+}
+
+// ---------- scope & decl analysis ----------
+// A type name a file added to known_types, at its first defining token.
+struct TypeEvent {
+    std::string name;
+    size_t pos;  // offset of the naming token
+};
+
+// Analyzer state between two tokens. Right after a '{' or '}' it is just
+// the current scope (pending kind/name are cleared there), which is what
+// lets IncrementalDoc re-run one scope body on its own.
+struct AnalyzeState {
+    int cur;  // scope of the next token
+    std::string pending_kind, pending_name;  // kind/name for the next '{'
+    std::map<int, std::vector<Param> > params_at_lbrace;  // by '{' index
+    std::vector<TypeEvent>* type_log;  // receives first additions, or 0
+    AnalyzeState() : cur(0), type_log(0) {}
+};
 
-    int cur = 0;
-    std::string pending_kind, pending_name;
-    std::map<int, std::vector<Param> > params_at_lbrace;
+static void add_known_type(std::set<std::string>& known_types,
+    AnalyzeState& st, const Token& t) {
+    if (!known_types.insert(t.text).second || !st.type_log) return;
+    st.type_log->push_back(TypeEvent());
+    st.type_log->back().name = t.text;
+    st.type_log->back().pos = t.pos;
+}
 
-    for (size_t i = 0; i < tk.size(); ++i) {
+// Function parameters become vars in the function scope.
+static void declare_params(std::map<std::string, VarInfo>& vars,
+    const std::vector<Param>& params) {
+    for (size_t k = 0; k < params.size(); ++k) {
+        const Param& p = params[k];
+        VarInfo& vi = vars[p.name];
+        if (vi.pointer_level == 999)
+            vi.pointer_level = p.stars;
+        else if (p.stars < vi.pointer_level)
+            vi.pointer_level = p.stars;
+    }
+}
+
+// Analyze tk[begin, end) starting from 'st'; lookahead may read past 'end'.
+static void analyze_range(std::vector<Token>& tk, size_t begin, size_t end,
+    AnalyzeState& st, std::vector<Scope>& scopes,
+    std::vector<std::map<std::string, VarInfo> >& scope_vars,
+    std::set<std::string>& known_types, FileProfile* prof) {
+    int& cur = st.cur;
+    std::string& pending_kind = st.pending_kind;
+    std::string& pending_name = st.pending_name;
+    std::map<int, std::vector<Param> >& params_at_lbrace = st.params_at_lbrace;
+
+    for (size_t i = begin; i < end; ++i) {
         tk[i].scope_id = cur;
+        if (prof) prof->mark_pos(tk[i].pos);
+
+        // initializer body "= { ... }": one flat Initializer scope for the
+        // whole (possibly nested) brace list; no declarations, no sub-scopes.
+        if (is_op(tk, (int)i, "=") && is_p(tk, (int)i + 1, "{")) {
+            size_t close = find_matching_brace(tk, i + 1);
+            if (close != tk.size()) {
+                Scope s;
+                s.id = (int)scopes.size();
+                s.parent = cur;
+                s.kind = "Initializer";
+                push_scope(scopes, scope_vars, s);
+                tk[i + 1].scope_id = cur;
+                for (size_t k = i + 2; k <= close; ++k) tk[k].scope_id = s.id;
+                pending_kind.clear();
+                pending_name.clear();
+                i = close;
+                continue;
+            }
+        }
 
-        // typedef adds a new known type (last identifier before ';' / '}')
-        if (is_kw(tk, (int)i, "typedef")) {
-            int last_ident = -1;
-            for (size_t j = i + 1;
-                j < tk.size() && !(tk[j].type == Token::Punct &&
-                    (tk[j].text == ";" || tk[j].text == "}"));
-                ++j)
-                if (tk[j].type == Token::Identifier) last_ident = (int)j;
-            if (last_ident != -1) known_types.insert(tk[last_ident].text);
-        }
-        // tag names of struct/union/enum become known types
+        int declared = declared_type_name(tk, i);
+        if (declared != -1) add_known_type(known_types, st, tk[declared]);
         if (is_kw(tk, (int)i, "struct") || is_kw(tk, (int)i, "enum") ||
             is_kw(tk, (int)i, "union")) {
-            if (i + 1 < tk.size() && tk[i + 1].type == Token::Identifier)
-                known_types.insert(tk[i + 1].text);
-
             // remember scope kind/name for the upcoming '{'
             if (is_kw(tk, (int)i, "struct"))
                 pending_kind = "Struct";
@@ -626,7 +1692,7 @@ static void analyze_scopes_and_vars(
         if (tk[i].type == Token::Identifier && known_types.count(tk[i].text))
             type_start = true;
         if (tk[i].type == Token::Keyword &&
-            (builtin_types().count(tk[i].text) || tk[i].text == "struct" ||
+            (is_builtin_type(tk[i].text) || tk[i].text == "struct" ||
                 tk[i].text == "enum" || tk[i].text == "union"))
             type_start = true;
 
@@ -637,9 +1703,8 @@ static void analyze_scopes_and_vars(
                 i_lbrace != -1) {
                 pending_kind = "Function";
                 pending_name = tk[i_name].text;
-                std::vector<Param> ps;
-                parse_params(tk, lp, rp, ps, known_types);
-                params_at_lbrace[i_lbrace] = ps;
+                parse_params(tk, lp, rp, params_at_lbrace[i_lbrace],
+                    known_types);
             }
         }
 
@@ -671,7 +1736,7 @@ static void analyze_scopes_and_vars(
                     }
                     if (!(j < tk.size() && tk[j].type == Token::Identifier))
                         break;
-                    const std::string name = tk[j].text;
+                    const std::string& name = tk[j].text;
                     ++j;
                     int arrays = 0;
                     while (j < tk.size() && is_p(tk, (int)j, "[")) {
@@ -718,23 +1783,13 @@ static void analyze_scopes_and_vars(
             s.parent = cur;
             s.kind = pending_kind.empty() ? "Block" : pending_kind;
             s.name = pending_name;
-            scopes.push_back(s);
-            scope_vars.push_back(std::map<std::string, VarInfo>());
+            push_scope(scopes, scope_vars, s);
             cur = s.id;
 
-            // function parameters become vars in function scope
             std::map<int, std::vector<Param> >::iterator pit =
                 params_at_lbrace.find((int)i);
-            if (pit != params_at_lbrace.end()) {
-                for (size_t k = 0; k < pit->second.size(); ++k) {
-                    const Param& p = pit->second[k];
-                    VarInfo& vi = scope_vars[cur][p.name];
-                    if (vi.pointer_level == 999)
-                        vi.pointer_level = p.stars;
-                    else if (p.stars < vi.pointer_level)
-                        vi.pointer_level = p.stars;
-                }
-            }
+            if (pit != params_at_lbrace.end())
+                declare_params(scope_vars[cur], pit->second);
             pending_kind.clear();
             pending_name.clear();
         }
@@ -747,8 +1802,29 @@ static void analyze_scopes_and_vars(
     }
 }
 
-static int resolve_ptr_level(
-    const std::vector<Scope>& scopes,
+static void analyze_scopes_and_vars(std::vector<Token>& tk,
+    std::vector<Scope>& scopes,
+    std::vector<std::map<std::string, VarInfo> >& scope_vars,
+    std::set<std::string>& known_types, FileProfile* prof,
+    AnalyzeState* state = 0, std::map<std::string, VarInfo>* globals = 0) {
+    scopes.clear();
+    scope_vars.clear();
+    Scope g;
+    g.id = 0;
+    g.parent = -1;
+    g.kind = "Global";
+    g.name = "";
+    push_scope(scopes, scope_vars, g);
+    // file-scope variables of earlier segments (the caller swaps them back)
+    if (globals) scope_vars[0].swap(*globals);
+
+    AnalyzeState local;
+    AnalyzeState& st = state ? *state : local;
+    analyze_range(tk, 0, tk.size(), st, scopes, scope_vars, known_types, prof);
+}
+
+static int resolve_ptr_level(
+    const std::vector<Scope>& scopes,
     const std::vector<std::map<std::string, VarInfo> >& scope_vars,
     int scope_id, const std::string& name, int& array_rank_out) {
     array_rank_out = 0;
@@ -772,23 +1848,27 @@ static void remove_semicolons_inside_enums(std::vector<Token>& toks,
     std::vector<Token> out;
     out.reserve(toks.size());
     for (size_t i = 0; i < toks.size(); ++i) {
-        const Token& t = toks[i];
+        Token& t = toks[i];
         if (t.type == Token::Punct && t.text == ";") {
             int sid = t.scope_id;
             if (sid >= 0 && sid < (int)scopes.size() &&
                 scopes[sid].kind == "Enum")
                 continue;
         }
-        out.push_back(t);
+        append_moved(out, t);
     }
     toks.swap(out);
 }
 
-// Add ';' after struct/union/enum *type blocks* when no declarator follows.
+// Add ';' after struct/union/enum *type blocks* when no declarator follows,
+// and after the closing '}' of an initializer body ("x = { ... }").
 static void add_semicolon_after_type_blocks(std::vector<Token>& toks,
-    const std::vector<Scope>& scopes) {
+    const std::vector<Scope>& scopes, bool type_blocks, bool initializers) {
+    std::vector<Token> out;
+    out.reserve(toks.size() + toks.size() / 16);
     for (size_t i = 0; i < toks.size(); ++i) {
-        const Token& t = toks[i];
+        append_moved(out, toks[i]);
+        const Token& t = out.back();  // not used past the next append
         if (t.type != Token::Punct || t.text != "}") continue;
 
         int sid = t.scope_id;
@@ -796,6 +1876,25 @@ static void add_semicolon_after_type_blocks(std::vector<Token>& toks,
 
         const std::string& kind =
             scopes[sid].kind;  // "Struct","Union","Enum","Block",...
+
+        if (kind == "Initializer") {
+            if (!initializers) continue;
+            // only the outermost '}' leaves the initializer scope
+            if (i + 1 < toks.size() && toks[i + 1].scope_id == sid) continue;
+            bool terminated = false;
+            if (i + 1 < toks.size()) {
+                const Token& n = toks[i + 1];
+                terminated = n.type == Token::Punct &&
+                    (n.text == ";" || n.text == "," || n.text == ")");
+            }
+            if (!terminated) {
+                CPLUS_PROBE2(semicolon__insert, t.pos, 2);
+                Token semi = synth_token(t, Token::Punct, ";");
+                append_moved(out, semi);
+            }
+            continue;
+        }
+        if (!type_blocks) continue;
         if (!(kind == "Struct" || kind == "Union" || kind == "Enum")) continue;
 
         // Look ahead to see if a declarator/';' already follows
@@ -815,72 +1914,75 @@ static void add_semicolon_after_type_blocks(std::vector<Token>& toks,
         }
 
         if (!declarator_follows) {
-            Token semi = t;
-            semi.type = Token::Punct;
-            semi.text = ";";
-            toks.insert(toks.begin() + (i + 1), semi);
-            ++i;  // skip the inserted ';'
+            CPLUS_PROBE2(semicolon__insert, t.pos, 2);
+            Token semi = synth_token(t, Token::Punct, ";");
+            append_moved(out, semi);
         }
     }
+    toks.swap(out);
 }
 
-// Split tokens into physical lines; track a representative scope per line.
-static void split_into_lines(const std::vector<Token>& toks,
-    std::vector<std::vector<Token> >& byline,
-    std::vector<int>& line_scope) {
+// Split tokens into physical lines (moving them out of 'toks'); track a
+// representative scope and the source line number (index into the lexer's
+// LineSummary table) per line. Token offsets only grow, so the line lookup
+// is one forward walk over 'index'.
+static void split_into_lines(std::vector<Token>& toks, const LineIndex& index,
+    const std::vector<LineSummary>& summaries,
+    std::vector<std::vector<Token> >& byline, std::vector<int>& line_scope,
+    std::vector<int>& line_no) {
     byline.clear();
     line_scope.clear();
+    line_no.clear();
     if (toks.empty()) return;
-    int current = toks.front().line;
-    byline.push_back(std::vector<Token>());
-    line_scope.push_back(toks.front().scope_id);
+    const int count = index.count();
+    int current = 0;
+    size_t next_line = 0;  // offset where line current + 1 starts
     for (size_t i = 0; i < toks.size(); ++i) {
-        if (toks[i].line != current) {
-            current = toks[i].line;
+        size_t last = token_last(toks[i]);
+        if (last >= next_line) {
+            while (current < count && index.starts[current + 1] <= last)
+                ++current;
+            next_line = current < count ? index.starts[current + 1]
+                                        : (size_t)-1;
             byline.push_back(std::vector<Token>());
             line_scope.push_back(toks[i].scope_id);
+            line_no.push_back(current);
+            if ((size_t)current < summaries.size()) {
+                const LineSummary& ls = summaries[current];
+                // room for a ';' and one "(*x)" wrap without regrowth
+                byline.back().reserve(ls.tok_end - ls.tok_begin + 4);
+            }
         }
-        byline.back().push_back(toks[i]);
+        byline.back().push_back(Token());
+        move_token(byline.back().back(), toks[i]);
     }
 }
 
 // Need a trailing ';'? (never inside enum bodies). Also handles initializer
-// lists ending with '}'.
+// lists ending with '}'. Constant time: keyword/'='/'{' presence comes from
+// the lexer's line summary; only the (possibly appended-to) tail is live.
 static bool needs_semicolon(const std::vector<Token>& line,
-    const std::string& scope_kind) {
+    const std::string& scope_kind, const LineSummary& summary) {
     if (line.empty()) return false;
-    if (scope_kind == "Enum") return false;
+    if (scope_kind == "Enum" || scope_kind == "Initializer") return false;
+    if (summary.first_type == Token::Preprocessor) return false;
 
-    const Token& first = line.front();
     const Token& last = line.back();
-    if (first.type == Token::Preprocessor) return false;
 
     // initializer list: "x = { ... }" ? needs ';'
     if (last.type == Token::Punct && last.text == "}") {
-        bool has_eq = false, has_lbrace = false;
-        for (size_t i = 0; i + 1 < line.size(); ++i) {
-            if (line[i].type == Token::Operator && line[i].text == "=")
-                has_eq = true;
-            if (line[i].type == Token::Punct && line[i].text == "{")
-                has_lbrace = true;
-        }
-        if (has_eq && has_lbrace) return true;
-        return false;  // otherwise likely a block/type close
+        const unsigned char init =
+            LineSummary::Assign | LineSummary::LBrace;
+        // otherwise likely a block/type close
+        return (summary.flags & init) == init;
     }
 
     if (last.type == Token::Punct && (last.text == "{" || last.text == ";"))
         return false;
 
-    bool has_ctrl = false;
-    for (size_t i = 0; i < line.size(); ++i) {
-        if (line[i].type == Token::Keyword &&
-            (line[i].text == "if" || line[i].text == "for" ||
-                line[i].text == "while" || line[i].text == "switch")) {
-            has_ctrl = true;
-            break;
-        }
-    }
-    if (has_ctrl && last.type == Token::Punct && last.text == ")") return false;
+    if ((summary.flags & LineSummary::Ctrl) && last.type == Token::Punct &&
+        last.text == ")")
+        return false;
 
     if (last.type == Token::Identifier || last.type == Token::Number ||
         last.type == Token::StringLit ||
@@ -895,7 +1997,11 @@ static bool needs_semicolon(const std::vector<Token>& line,
 // '(*base)->member'.
 static void rewrite_member_chains(
     std::vector<Token>& line, int scope_id, const std::vector<Scope>& scopes,
-    const std::vector<std::map<std::string, VarInfo> >& scope_vars) {
+    const std::vector<std::map<std::string, VarInfo> >& scope_vars,
+    const LineSummary& summary) {
+    // no '.' on the line: nothing to rewrite, skip all symbol lookups
+    if (!(summary.flags & LineSummary::Dot)) return;
+
     for (size_t i = 0; i < line.size(); ++i) {
         if (line[i].type != Token::Identifier) continue;
 
@@ -959,20 +2065,15 @@ static void rewrite_member_chains(
         // Rewrite ". <ident>" segments based on effective pointer depth
         while (j + 1 < line.size() && line[j].type == Token::Punct &&
             line[j].text == "." && line[j + 1].type == Token::Identifier) {
+            CPLUS_PROBE2(member__access, line[j].pos, cur_ptr);
             if (cur_ptr == 1) {
                 line[j].type = Token::Operator;
                 line[j].text = "->";
             }
             else if (cur_ptr > 1) {
-                Token lpar = line[i];
-                lpar.type = Token::Punct;
-                lpar.text = "(";
-                Token star = line[i];
-                star.type = Token::Operator;
-                star.text = "*";
-                Token rpar = line[j];
-                rpar.type = Token::Punct;
-                rpar.text = ")";
+                Token lpar = synth_token(line[i], Token::Punct, "(");
+                Token star = synth_token(line[i], Token::Operator, "*");
+                Token rpar = synth_token(line[j], Token::Punct, ")");
 
                 line.insert(line.begin() + i, lpar);
                 line.insert(line.begin() + i + 1, star);
@@ -995,12 +2096,18 @@ static void rewrite_member_chains(
 }
 
 // Insert a ';' immediately before any '}' on the same physical line when needed
-// (not in enums).
+// (not in enums, not for braces of initializer bodies).
 static void insert_semicolon_before_closing_brace_on_line(
-    std::vector<Token>& line, const std::string& scope_kind) {
-    if (scope_kind == "Enum") return;
+    std::vector<Token>& line, const std::string& scope_kind,
+    const std::vector<Scope>& scopes, const LineSummary& summary) {
+    if (scope_kind == "Enum" || scope_kind == "Initializer") return;
+    if (!(summary.flags & LineSummary::RBrace)) return;
     for (size_t i = 1; i < line.size(); ++i) {
         if (line[i].type == Token::Punct && line[i].text == "}") {
+            int sid = line[i].scope_id;
+            if (sid >= 0 && sid < (int)scopes.size() &&
+                scopes[sid].kind == "Initializer")
+                continue;
             const Token& prev = line[i - 1];
             if (prev.type == Token::Punct &&
                 (prev.text == ";" || prev.text == "{"))
@@ -1012,9 +2119,8 @@ static void insert_semicolon_before_closing_brace_on_line(
                     (prev.text == ")" || prev.text == "]")) ||
                 (prev.type == Token::Operator);
             if (need) {
-                Token semi = prev;
-                semi.type = Token::Punct;
-                semi.text = ";";
+                CPLUS_PROBE2(semicolon__insert, prev.pos, 1);
+                Token semi = synth_token(prev, Token::Punct, ";");
                 line.insert(line.begin() + i, semi);
                 ++i;
             }
@@ -1022,18 +2128,19 @@ static void insert_semicolon_before_closing_brace_on_line(
     }
 }
 
-// Emit a line to an arbitrary ostream (used to capture into a .cpp file)
-static void emit_line(const std::vector<Token>& line, std::ostream& os) {
+// Append a line to the output text (captured into a .cpp file)
+static void emit_line(const std::vector<Token>& line, std::string& out) {
     if (line.empty()) {
-        os << "\n";
+        out += '\n';
         return;
     }
     bool bol = true;
     for (size_t i = 0; i < line.size(); ++i) {
         const Token& t = line[i];
         if (t.type == Token::Preprocessor) {
-            if (!bol) os << "\n";
-            os << t.text << "\n";
+            if (!bol) out += '\n';
+            out += t.text;
+            out += '\n';
             return;
         }
         bool space = !bol;
@@ -1046,81 +2153,3749 @@ static void emit_line(const std::vector<Token>& line, std::ostream& os) {
         }
         if (t.type == Token::Operator && t.text == "->") { /*stick*/
         }
-        if (space) os << " ";
-        os << t.text;
+        if (space) out += ' ';
+        out += t.text;
         bol = false;
     }
-    os << "\n";
+    out += '\n';
 }
 
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        std::fprintf(stderr, "Usage: %s <file1.cp> [file2.cp ...]\n", argv[0]);
+// ----- startup benchmark -----
+// Cold exec-to-exit latency of this binary on a one-line input. Startup is
+// paid once per file in make-driven flows, so it is tracked like throughput.
+// Returns the process exit code (1 if a run failed or the median is over
+// budget_us, when budget_us > 0).
+static int bench_startup(const char* argv0, int runs, double budget_us) {
+#ifdef CPLUS_POSIX
+    // mkstemp (mkstemps is not POSIX), then a hard link adds the .cp
+    // suffix; unlike rename, link fails rather than replace an existing name
+    char tmppath[] = "/tmp/cplus_startup_XXXXXX";
+    int fd = ::mkstemp(tmppath);
+    std::string in = std::string(tmppath) + ".cp";
+    if (fd >= 0) {
+        if (::link(tmppath, in.c_str()) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        ::unlink(tmppath);
+    }
+    if (fd < 0) {
+        std::fprintf(stderr, "Error: cannot create temp input\n");
         return 1;
     }
+    char* inpath = &in[0];
+    const char one_line[] = "int x = 1\n";
+    bool ok = ::write(fd, one_line, sizeof(one_line) - 1) ==
+        (ssize_t)(sizeof(one_line) - 1);
+    ::close(fd);
+    std::string outpath = replace_ext(in, ".cpp");
 
-    std::set<std::string> known_types = builtin_types();
+    const char* self = argv0;
+#ifdef __linux__
+    if (::access("/proc/self/exe", X_OK) == 0) self = "/proc/self/exe";
+#endif
+    std::vector<double> us;
+    for (int r = 0; ok && r < runs; ++r) {
+        double t0 = now_ns();
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            int devnull = ::open("/dev/null", O_WRONLY);
+            if (devnull >= 0) {
+                ::dup2(devnull, 1);
+                ::dup2(devnull, 2);
+            }
+            char* const args[] = { (char*)self, inpath, 0 };
+            ::execv(self, args);
+            ::_exit(127);
+        }
+        int status = 0;
+        if (pid < 0 || ::waitpid(pid, &status, 0) != pid ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ok = false;
+        us.push_back((now_ns() - t0) / 1e3);
+    }
+    ::unlink(inpath);
+    ::unlink(outpath.c_str());
+    if (!ok || us.empty()) {
+        std::fprintf(stderr, "Error: startup benchmark run failed\n");
+        return 1;
+    }
 
-    int exit_code = 0;
-    for (int ai = 1; ai < argc; ++ai) {
-        const char* inpath = argv[ai];
-        std::string src;
-        if (!read_file(inpath, src)) {
-            std::fprintf(stderr, "Error: cannot read: %s\n", inpath);
-            exit_code = 1;
+    std::sort(us.begin(), us.end());
+    double median = us[us.size() / 2];
+    std::fprintf(stderr,
+        "startup: %d runs on a one-line input: min %.0f us, median %.0f us, "
+        "max %.0f us\n",
+        (int)us.size(), us.front(), median, us.back());
+    if (budget_us > 0 && median > budget_us) {
+        std::fprintf(stderr, "startup: median over budget of %.0f us\n",
+            budget_us);
+        return 1;
+    }
+    return 0;
+#else
+    (void)argv0;
+    (void)runs;
+    (void)budget_us;
+    std::fprintf(stderr, "Error: --bench-startup needs a POSIX system\n");
+    return 1;
+#endif
+}
+
+// ----- dialects -----
+// Each C+ variant is a policy of compile-time pass switches; convert_source<>
+// is instantiated once per policy so disabled passes vanish from the hot loop.
+struct DialectFull {  // C+: '.' for pointers, EOL semicolons
+    static const bool rewrite_members = true;
+    static const bool eol_semicolons = true;
+    static const bool strip_enum_semicolons = true;
+    static const bool type_block_semicolons = true;
+};
+struct DialectMembers {  // '.' -> '->' only; source already has its ';'
+    static const bool rewrite_members = true;
+    static const bool eol_semicolons = false;
+    static const bool strip_enum_semicolons = false;
+    static const bool type_block_semicolons = false;
+};
+struct DialectSemicolons {  // EOL semicolons only; source already uses '->'
+    static const bool rewrite_members = false;
+    static const bool eol_semicolons = true;
+    static const bool strip_enum_semicolons = true;
+    static const bool type_block_semicolons = true;
+};
+
+// The whole-token-stream passes that run between analysis and line split.
+template <class Dialect>
+static void run_token_passes(std::vector<Token>& toks,
+    const std::vector<Scope>& scopes) {
+    if (Dialect::strip_enum_semicolons)
+        remove_semicolons_inside_enums(toks, scopes);
+    if (Dialect::type_block_semicolons || Dialect::eol_semicolons)
+        add_semicolon_after_type_blocks(toks, scopes,
+            Dialect::type_block_semicolons, Dialect::eol_semicolons);
+}
+
+// Rewrite one physical line (scope 'sid') and append it to 'out'.
+template <class Dialect>
+static void convert_line(std::vector<Token>& line, int sid,
+    const LineSummary& summary, const std::vector<Scope>& scopes,
+    const std::vector<std::map<std::string, VarInfo> >& scope_vars,
+    std::string& out) {
+    // '.' to '->' (scope-aware; handles arrays, calls; wraps (**+) as
+    // (*x) before '->')
+    if (Dialect::rewrite_members)
+        rewrite_member_chains(line, sid, scopes, scope_vars, summary);
+
+    if (Dialect::eol_semicolons) {
+        const std::string& kind =
+            (sid < (int)scopes.size() ? scopes[sid].kind
+                : std::string("Global"));
+        insert_semicolon_before_closing_brace_on_line(line, kind, scopes,
+            summary);
+
+        if (!line.empty() && needs_semicolon(line, kind, summary)) {
+            const Token& last = line.back();
+            Token semi;
+            semi.type = Token::Punct;
+            semi.text = ";";
+            semi.pos = last.pos + last.text.size();
+            CPLUS_PROBE2(semicolon__insert, semi.pos, 0);
+            line.push_back(semi);
+        }
+    }
+    emit_line(line, out);
+}
+
+// What one segment of a streamed file carries to the next (see
+// StreamConverter): the file-scope variables declared so far, and where the
+// segment's own lines end and its lookahead begins.
+struct SegmentContext {
+    std::map<std::string, VarInfo> globals;
+    size_t emit_end;  // lines starting at or past this offset are not emitted
+    SegmentContext() : emit_end(0) {}
+};
+
+// Source position of every output line, recorded while emitting (for the
+// --line-map sidecar): the offset of the line's first token in the folded
+// text, until unfold() turns offsets into lines and columns of the file
+// as written (before CRLF and backslash-newline folding).
+struct LineMap {
+    std::vector<size_t> pos;     // per output line
+    std::vector<int> line, col;  // per output line after unfold(), 1-based
+
+    // 'text' was just emitted for a source line starting at 'at'.
+    void record(size_t at, const char* text, size_t n) {
+        for (const char* e = text + n;
+            (text = (const char*)std::memchr(text, '\n', e - text)) != 0;
+            ++text)
+            pos.push_back(at);
+    }
+
+    void unfold(const std::string& raw) {
+        line.resize(pos.size());
+        col.resize(pos.size());
+        size_t r = 0, f = 0;  // raw and folded offsets
+        int ln = 1, cn = 1;
+        for (size_t k = 0; k < pos.size(); ++k) {
+            if (pos[k] < f) {  // not in order: walk again from the top
+                r = f = 0;
+                ln = cn = 1;
+            }
+            while (r < raw.size()) {
+                // CR before LF and backslash-newline fold away
+                size_t nl = r + 1 < raw.size() && raw[r] == '\\'
+                    ? newline_at(raw, r + 1)
+                    : 0;
+                if (nl) {
+                    r += 1 + nl;
+                    ++ln;
+                    cn = 1;
+                    continue;
+                }
+                if (raw[r] == '\r' && r + 1 < raw.size() &&
+                    raw[r + 1] == '\n') {
+                    ++r;
+                    continue;
+                }
+                if (f == pos[k]) break;
+                if (raw[r] == '\n' || raw[r] == '\r') {
+                    ++ln;
+                    cn = 1;
+                }
+                else
+                    ++cn;
+                ++r;
+                ++f;
+            }
+            line[k] = ln;
+            col[k] = cn;
+        }
+    }
+
+private:
+    // Length of the newline at raw[i] ("\n", "\r\n" or "\r"), else 0.
+    static size_t newline_at(const std::string& raw, size_t i) {
+        if (raw[i] == '\n') return 1;
+        if (raw[i] != '\r') return 0;
+        return i + 1 < raw.size() && raw[i + 1] == '\n' ? 2 : 1;
+    }
+};
+
+// Analysis, token passes, line split and per-line rewrite of a lexed
+// file: everything after lex(), shared by text, token-stream and streamed
+// input. 'index' maps token offsets to lines; 'text_size' sizes the output.
+template <class Dialect>
+static void convert_lexed(std::vector<Token>& toks,
+    const std::vector<LineSummary>& summaries, const LineIndex& index,
+    size_t text_size, std::set<std::string>& known_types, std::string& out,
+    FileProfile* prof, SegmentContext* seg = 0, LineMap* map = 0) {
+    if (prof) prof->index = &index;
+    std::vector<Scope> scopes;
+    std::vector<std::map<std::string, VarInfo> > scope_vars;
+    CPLUS_PROBE1(phase__start, "analyze");
+    CPLUS_TRACE_CLOCK(t_analyze);
+    if (prof) prof->begin(FileProfile::Analyze);
+    analyze_scopes_and_vars(toks, scopes, scope_vars, known_types, prof, 0,
+        seg ? &seg->globals : 0);
+    if (prof) prof->end();
+    CPLUS_PROBE3(phase__end, "analyze", toks.size(),
+        CPLUS_TRACE_NS(t_analyze));
+
+    CPLUS_PROBE1(phase__start, "passes");
+    CPLUS_TRACE_CLOCK(t_passes);
+    if (prof) prof->begin(FileProfile::Passes);
+    run_token_passes<Dialect>(toks, scopes);
+
+    std::vector<std::vector<Token> > lines;
+    std::vector<int> line_scope;
+    std::vector<int> line_no;
+    split_into_lines(toks, index, summaries, lines, line_scope, line_no);
+    if (prof) prof->end();
+    CPLUS_PROBE3(phase__end, "passes", lines.size(), CPLUS_TRACE_NS(t_passes));
+
+    CPLUS_PROBE1(phase__start, "rewrite/emit");
+    CPLUS_TRACE_CLOCK(t_lines);
+    if (prof) prof->begin(FileProfile::Lines);
+    out.reserve(out.size() + text_size + text_size / 8);
+    for (size_t li = 0; li < lines.size(); ++li) {
+        std::vector<Token>& line = lines[li];
+        int sid = (li < line_scope.size() ? line_scope[li] : 0);
+        const LineSummary& summary = summaries[line_no[li]];
+        size_t at = line.front().pos;
+        if (seg && at >= seg->emit_end) break;
+        if (prof) prof->mark(line_no[li]);
+        size_t before = out.size();
+        convert_line<Dialect>(line, sid, summary, scopes, scope_vars, out);
+        if (map) map->record(at, out.data() + before, out.size() - before);
+    }
+    if (seg) seg->globals.swap(scope_vars[0]);
+    if (prof) {
+        prof->end();
+        prof->index = 0;
+    }
+    CPLUS_PROBE3(phase__end, "rewrite/emit", lines.size(),
+        CPLUS_TRACE_NS(t_lines));
+}
+
+// Convert one C+ source text to C++98.
+// known_types starts with builtins and grows per file (typedefs add to it).
+// 'map', if given, receives the source line and column of each output line.
+template <class Dialect>
+static void convert_source(const std::string& src,
+    std::set<std::string>& known_types, std::string& out,
+    FileProfile* prof, LineMap* map = 0) {
+    CPLUS_PROBE1(phase__start, "preprocess");
+    CPLUS_TRACE_CLOCK(t_pre);
+    if (prof) prof->begin(FileProfile::Preprocess);
+    std::string pre = preprocess_physical_lines(src);
+    if (prof) prof->end();
+    CPLUS_PROBE3(phase__end, "preprocess", pre.size(), CPLUS_TRACE_NS(t_pre));
+
+    std::vector<Token> toks;
+    std::vector<LineSummary> summaries;
+    CPLUS_PROBE1(phase__start, "lex");
+    CPLUS_TRACE_CLOCK(t_lex);
+    if (prof) prof->begin(FileProfile::Lex);
+    lex(pre, toks, summaries, Dialect::rewrite_members, prof);
+    LineIndex index;
+    index.build(pre);
+    if (prof) prof->end();
+    CPLUS_PROBE3(phase__end, "lex", toks.size(), CPLUS_TRACE_NS(t_lex));
+    convert_lexed<Dialect>(toks, summaries, index, pre.size(), known_types,
+        out, prof, 0, map);
+    if (map) map->unfold(src);
+}
+
+// ----- token-stream input -----
+// Code generators that already hold C+ as tokens can hand them over instead
+// of printing text for lex() to split again. A TokenStream is the token
+// sequence plus its line breaks, which is all EOL ';' inference needs. Texts
+// are interned, so the keyword test runs once per distinct text rather than
+// once per token, and a caller may push Identifier for keywords too.
+// Texts must be split the way lex() splits them: '+=' is one Operator, a
+// string literal one StringLit with its quotes, a directive one
+// Preprocessor token alone on its line; comments are simply not pushed.
+// The conversion equals that of the text the stream prints as: tokens
+// separated by one space, lines by '\n' (offsets in errors refer to it).
+struct TokenStream {
+    struct Item {
+        int type;  // Token::Type
+        int text;  // index into 'texts'; -1 marks a line break
+    };
+    std::vector<std::string> texts;
+    std::vector<Item> items;
+
+    int intern(const std::string& s) {
+        std::map<std::string, int>::iterator it = ids.find(s);
+        if (it != ids.end()) return it->second;
+        ids.insert(std::make_pair(s, (int)texts.size()));
+        texts.push_back(s);
+        return (int)texts.size() - 1;
+    }
+    void push(Token::Type type, int text) {
+        Item it;
+        it.type = type;
+        it.text = text;
+        items.push_back(it);
+    }
+    void push(Token::Type type, const std::string& s) {
+        push(type, intern(s));
+    }
+    void newline() { push(Token::Unknown, -1); }
+    void clear() {
+        texts.clear();
+        items.clear();
+        ids.clear();
+    }
+
+private:
+    std::map<std::string, int> ids;
+};
+
+// Convert a token stream. A '->' in a dialect that forbids it is not
+// fatal here: the call returns false with 'error' (if given) filled in and
+// leaves 'out' and known_types untouched.
+template <class Dialect>
+static bool convert_tokens(const TokenStream& in,
+    std::set<std::string>& known_types, std::string& out,
+    LexError* error) {
+    std::set<std::string> kw = make_keywords();
+    std::vector<signed char> is_kw(in.texts.size(), -1);
+    std::vector<Token> toks;
+    std::vector<LineSummary> summaries;
+    toks.reserve(in.items.size());
+    LineIndex index;
+    index.starts.assign(2, 0);  // lines are 1-based
+    size_t pos = 0;
+    int line = 1;
+    bool bol = true;
+    for (size_t i = 0; i < in.items.size(); ++i) {
+        const TokenStream::Item& item = in.items[i];
+        if (item.text < 0) {
+            index.starts.push_back(++pos);
+            ++line;
+            bol = true;
             continue;
         }
+        const std::string& s = in.texts[item.text];
+        if (!bol) ++pos;
+        bol = false;
+        Token t;
+        t.type = (Token::Type)item.type;
+        if (t.type == Token::Identifier || t.type == Token::Keyword) {
+            signed char& k = is_kw[item.text];
+            if (k < 0) k = kw.count(s) ? 1 : 0;
+            t.type = k ? Token::Keyword : Token::Identifier;
+        }
+        else if (Dialect::rewrite_members && t.type == Token::Operator &&
+            s == "->") {
+            if (error) {
+                error->line = line;
+                error->col = (int)(pos - index.starts[line]) + 1;
+                error->message = "'->' is not allowed; pointers use '.' in C+";
+            }
+            return false;
+        }
+        t.text = s;
+        t.pos = pos;
+        // a multi-line literal or directive ends on a later line
+        for (size_t k = s.find('\n'); k != std::string::npos;
+            k = s.find('\n', k + 1)) {
+            index.starts.push_back(pos + k + 1);
+            ++line;
+        }
+        pos += s.size();
+        push_token(toks, summaries, t, line);
+    }
+    convert_lexed<Dialect>(toks, summaries, index, pos, known_types, out, 0);
+    return true;
+}
 
-        std::string pre = preprocess_physical_lines(src);
-        std::vector<Token> toks;
-        lex(pre, toks);
+// Convert one preprocessed segment of a streamed file: its lines before
+// ctx.emit_end, seeing one token past it (the lookahead the '}' decisions of
+// add_semicolon_after_type_blocks need). A '->' that the dialect forbids
+// returns false with 'error' filled in (line and column within 'text').
+template <class Dialect>
+static bool convert_segment(const std::string& text,
+    std::set<std::string>& known_types, SegmentContext& ctx,
+    std::string& out, LexError* error) {
+    std::vector<Token> toks;
+    std::vector<LineSummary> summaries;
+    std::vector<LexError> errors;
+    lex(text, toks, summaries, Dialect::rewrite_members, 0, 0, &errors);
+    if (!errors.empty()) {
+        if (error) *error = errors[0];
+        return false;
+    }
+    // only the first lookahead token: the rest of its line is incomplete
+    size_t keep = 0;
+    while (keep < toks.size() && toks[keep].pos < ctx.emit_end) ++keep;
+    if (keep < toks.size()) toks.resize(keep + 1);
+    LineIndex index;
+    index.build(text);
+    convert_lexed<Dialect>(toks, summaries, index, ctx.emit_end, known_types,
+        out, 0, &ctx);
+    return true;
+}
 
-        std::vector<Scope> scopes;
-        std::vector<std::map<std::string, VarInfo> > scope_vars;
-        // known_types starts with builtins and grows per file (typedefs add to
-        // it).
-        analyze_scopes_and_vars(toks, scopes, scope_vars, known_types);
+typedef void (*ConvertFn)(const std::string&, std::set<std::string>&,
+    std::string&, FileProfile*, LineMap*);
+typedef bool (*ConvertTokensFn)(const TokenStream&, std::set<std::string>&,
+    std::string&, LexError*);
+typedef bool (*ConvertSegmentFn)(const std::string&, std::set<std::string>&,
+    SegmentContext&, std::string&, LexError*);
 
-        remove_semicolons_inside_enums(toks, scopes);
-        add_semicolon_after_type_blocks(toks, scopes);
+struct DialectEntry {
+    const char* name;
+    ConvertFn convert;
+    ConvertTokensFn convert_tokens;
+    ConvertSegmentFn convert_segment;
+};
 
-        std::vector<std::vector<Token> > lines;
-        std::vector<int> line_scope;
-        split_into_lines(toks, lines, line_scope);
+static const DialectEntry kDialects[] = {
+    { "full", &convert_source<DialectFull>, &convert_tokens<DialectFull>,
+        &convert_segment<DialectFull> },
+    { "members", &convert_source<DialectMembers>,
+        &convert_tokens<DialectMembers>, &convert_segment<DialectMembers> },
+    { "semicolons", &convert_source<DialectSemicolons>,
+        &convert_tokens<DialectSemicolons>,
+        &convert_segment<DialectSemicolons> },
+};
 
-        std::ostringstream outcpp;
-        for (size_t li = 0; li < lines.size(); ++li) {
-            std::vector<Token>& line = lines[li];
-            int sid = (li < line_scope.size() ? line_scope[li] : 0);
-
-            // '.' to '->' (scope-aware; handles arrays, calls; wraps (**+) as
-            // (*x) before '->')
-            rewrite_member_chains(line, sid, scopes, scope_vars);
-
-            const std::string& kind =
-                (sid < (int)scopes.size() ? scopes[sid].kind
-                    : std::string("Global"));
-            insert_semicolon_before_closing_brace_on_line(line, kind);
-
-            if (!line.empty() && needs_semicolon(line, kind)) {
-                Token semi;
-                semi.type = Token::Punct;
-                semi.text = ";";
-                semi.line = line.back().line;
-                semi.col = line.back().col + 1;
-                line.push_back(semi);
+static const DialectEntry* find_dialect(const char* name) {
+    for (size_t i = 0; i < sizeof(kDialects) / sizeof(kDialects[0]); ++i)
+        if (std::strcmp(kDialects[i].name, name) == 0) return &kDialects[i];
+    return 0;
+}
+
+// ----- streamed input -----
+// A StreamConverter converts one file that arrives in chunks (a pipe, a
+// socket) and hands output back as soon as it is final, so output flows
+// before the input has ended:
+//
+//   StreamConverter sc(&kDialects[0], known_types);
+//   while (...) sc.feed(chunk, n, out);  // 'out' grows by whole lines
+//   sc.finish(out);
+//
+// Input is cut only before a line at file scope (outside every bracket,
+// comment, string and directive) that starts with an identifier or ';'.
+// The text before the cut is converted as one segment that also lexes the
+// first token after it, which is all the lookahead the '}' decisions need;
+// a line starting with '{' never begins a segment, so a signature stays
+// with its body. What stays buffered is the current top-level declaration
+// plus the unscanned tail of the last chunk. known_types and the
+// file-scope variables carry over between segments; a variable is visible
+// from its declaration on, as in C.
+//
+// A '->' the dialect forbids fails feed() or finish() with error() set
+// (line and column in the whole input); the stream then stays failed.
+struct StreamConverter {
+    StreamConverter(const DialectEntry* d, std::set<std::string>& types)
+        : dialect(d), known_types(types), scanned(0), mode(Code), depth(0),
+        conds(0), line_start(0), directive(0), line_head(true), line_ok(true),
+        cut(0), lookahead(0), candidate(0), line_base(0), failed(false),
+        peak(0) {}
+
+    bool feed(const char* data, size_t n, std::string& out) {
+        if (failed) return false;
+        buf.append(data, n);
+        if (buf.size() > peak) peak = buf.size();
+        scan();
+        return cut == 0 || flush(cut, lookahead, out);
+    }
+
+    bool finish(std::string& out) {
+        if (failed) return false;
+        return buf.empty() || flush(buf.size(), buf.size(), out);
+    }
+
+    const LexError& error() const { return err; }
+    size_t peak_buffered() const { return peak; }  // bytes held at once
+
+private:
+    enum Mode { Code, LineComment, BlockComment, String, Char, Directive };
+
+    const DialectEntry* dialect;
+    std::set<std::string>& known_types;
+    SegmentContext ctx;
+    std::string buf;     // raw input not converted yet
+    size_t scanned;      // buf[0, scanned) has been scanned
+    Mode mode;
+    int depth;           // open '{' '(' '['
+    int conds;           // open #if groups
+    size_t line_start;   // offset of the current line
+    size_t directive;    // offset of the current directive's '#'
+    bool line_head;      // only blanks so far on the current line
+    bool line_ok;        // the current line began in code
+    size_t cut;          // last safe cut (0: none yet)
+    size_t lookahead;    // end of the line that starts at 'cut'
+    size_t candidate;    // the current line may become a cut
+    int line_base;       // lines converted so far (after folding)
+    bool failed;
+    LexError err;
+    size_t peak;
+
+    // Advance the scanner over new input. Stops short of a character whose
+    // meaning depends on the next one, until that one arrives.
+    void scan() {
+        size_t i = scanned;
+        for (; i < buf.size(); ++i) {
+            char c = buf[i];
+            bool last = i + 1 == buf.size();
+            if (c == '\\' || (c == '/' && mode == Code) ||
+                (c == '*' && mode == BlockComment)) {
+                if (last) break;
+            }
+            if (c == '\n') {
+                end_line(i);
+                continue;
+            }
+            switch (mode) {
+            case LineComment:
+                break;
+            case BlockComment:
+                if (c == '*' && buf[i + 1] == '/') {
+                    mode = Code;
+                    ++i;
+                }
+                break;
+            case String:
+            case Char:
+                if (c == '\\')
+                    ++i;
+                else if (c == (mode == String ? '"' : '\''))
+                    mode = Code;
+                break;
+            case Directive:
+                break;
+            case Code:
+                if (std::isspace((unsigned char)c)) break;
+                if (line_head) {
+                    line_head = false;
+                    if (line_ok && depth == 0 && conds == 0 &&
+                        line_start > 0 && (isIdentStart(c) || c == ';'))
+                        candidate = line_start;
+                    if (c == '#') {
+                        mode = Directive;
+                        directive = i;
+                        break;
+                    }
+                }
+                if (c == '/' && buf[i + 1] == '/') {
+                    mode = LineComment;
+                    ++i;
+                }
+                else if (c == '/' && buf[i + 1] == '*') {
+                    mode = BlockComment;
+                    ++i;
+                }
+                else if (c == '"')
+                    mode = String;
+                else if (c == '\'')
+                    mode = Char;
+                else if (c == '{' || c == '(' || c == '[')
+                    ++depth;
+                else if (c == '}' || c == ')' || c == ']')
+                    --depth;
+                break;
             }
-            emit_line(line, outcpp);
         }
+        scanned = i;
+    }
 
-        std::string outpath = replace_ext(inpath, ".cpp");
-        if (!write_text_file(outpath, outcpp.str())) {
-            std::fprintf(stderr, "Error: cannot write: %s\n", outpath.c_str());
-            exit_code = 1;
+    // buf[i] is '\n'. A backslash before it continues the line.
+    void end_line(size_t i) {
+        if ((i > 0 && buf[i - 1] == '\\') ||
+            (i > 1 && buf[i - 1] == '\r' && buf[i - 2] == '\\'))
+            return;
+        if (candidate == line_start && candidate > 0) {
+            cut = candidate;
+            lookahead = i + 1;
+        }
+        // a cut inside an #if group would split a branch the lexer skips
+        if (mode == Directive) {
+            const char* rest;
+            CondDirective d =
+                cond_directive(buf.data() + directive, buf.data() + i, rest);
+            if (d == CondIf || d == CondIfdef || d == CondIfndef)
+                ++conds;
+            else if (d == CondEndif && conds > 0)
+                --conds;
+        }
+        if (mode == LineComment || mode == Directive) mode = Code;
+        line_start = i + 1;
+        line_head = true;
+        line_ok = mode == Code;
+        candidate = 0;
+    }
+
+    // Convert buf[0, end), looking ahead into buf[end, la_end), and drop it.
+    bool flush(size_t end, size_t la_end, std::string& out) {
+        std::string text = preprocess_physical_lines(buf.substr(0, end));
+        ctx.emit_end = text.size();
+        int lines = (int)std::count(text.begin(), text.end(), '\n');
+        text += preprocess_physical_lines(buf.substr(end, la_end - end));
+        if (!dialect->convert_segment(text, known_types, ctx, out, &err)) {
+            err.line += line_base;
+            failed = true;
+            return false;
+        }
+        line_base += lines;
+        buf.erase(0, end);
+        scanned -= std::min(scanned, end);
+        line_start -= std::min(line_start, end);
+        directive -= std::min(directive, end);
+        candidate = candidate > end ? candidate - end : 0;
+        cut = 0;
+        return true;
+    }
+};
+
+static bool write_stdout(const std::string& s) {
+#ifdef CPLUS_POSIX
+    size_t done = 0;
+    while (done < s.size()) {
+        ssize_t n = ::write(1, s.data() + done, s.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+#else
+    return std::fwrite(s.data(), 1, s.size(), stdout) == s.size() &&
+        std::fflush(stdout) == 0;
+#endif
+}
+
+// --stream: stdin to stdout through a StreamConverter, writing each batch
+// of final lines as soon as a chunk yields it.
+static int stream_stdio(const DialectEntry* dialect) {
+    std::set<std::string> known_types = builtin_types();
+    StreamConverter sc(dialect, known_types);
+    std::string out;
+    char chunk[65536];
+    bool ok = true;
+    for (;;) {
+#ifdef CPLUS_POSIX
+        ssize_t n = ::read(0, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            std::fprintf(stderr, "Error: cannot read stdin: %s\n",
+                std::strerror(errno));
+            return 1;
+        }
+#else
+        size_t n = std::fread(chunk, 1, sizeof(chunk), stdin);
+#endif
+        out.clear();
+        if (n == 0)
+            ok = sc.finish(out);
+        else
+            ok = sc.feed(chunk, (size_t)n, out);
+        if (!ok) break;
+        if (!write_stdout(out)) {
+            std::fprintf(stderr, "Error: cannot write stdout\n");
+            return 1;
+        }
+        if (n == 0) return 0;
+    }
+    const LexError& e = sc.error();
+    std::fprintf(stderr,
+        "C+ error: '->' is not allowed (line %d, col %d). Pointers use '.' "
+        "in C+.\n",
+        e.line, e.col);
+    return 2;
+}
+
+// ----- incremental documents -----
+// IncrementalDoc keeps one C+ document converted (full dialect) together
+// with the tokens, scopes and symbol tables the conversion derived, and
+// applies byte-range edits. An edit re-lexes only the lines it touches,
+// re-analyzes only the body of the innermost scope whose '{' and '}' lie on
+// untouched lines, and re-emits only that body's lines; the output change
+// comes back as one line hunk. It rebuilds from scratch (or re-analyzes the
+// whole token stream) whenever the short path could differ from a full
+// conversion:
+//   - the text has backslash-newline continuations or lone CRs;
+//   - a comment or string literal crosses the boundary of the edited lines;
+//   - there is no enclosing scope, or its braces no longer match;
+//   - a typedef before the scope could read into it (no ';' or '}' between);
+//   - the scope now introduces a different set of type names.
+// Apart from that work an edit costs only memmove-class bookkeeping over the
+// document (splicing the per-line tables, shifting later token offsets).
+struct LineDiff {
+    int first;                       // first replaced output line (0-based)
+    int removed;                     // output lines replaced
+    std::vector<std::string> lines;  // replacement lines, without '\n'
+    LineDiff() : first(0), removed(0) {}
+};
+
+// Resize v[at, at + old_n) to new_n elements, shifting the tail by swaps.
+// The first min(old_n, new_n) slots keep stale values for the caller to
+// overwrite.
+template <class T>
+static void resize_gap(std::vector<T>& v, size_t at, size_t old_n,
+    size_t new_n) {
+    if (new_n > old_n) {
+        size_t grow = new_n - old_n;
+        v.resize(v.size() + grow);
+        for (size_t k = v.size() - 1; k >= at + new_n; --k)
+            std::swap(v[k], v[k - grow]);
+    }
+    else if (new_n < old_n) {
+        size_t shrink = old_n - new_n;
+        for (size_t k = at + new_n; k + shrink < v.size(); ++k)
+            std::swap(v[k], v[k + shrink]);
+        v.resize(v.size() - shrink);
+    }
+}
+
+// Replace v[at, at + old_n) with 'repl' (moved out), shifting by token moves.
+static void splice_tokens(std::vector<Token>& v, size_t at, size_t old_n,
+    std::vector<Token>& repl) {
+    size_t new_n = repl.size();
+    if (new_n > old_n) {
+        size_t grow = new_n - old_n;
+        while (v.size() + grow > v.capacity()) grow_tokens(v);
+        v.resize(v.size() + grow);
+        for (size_t k = v.size() - 1; k >= at + new_n; --k)
+            move_token(v[k], v[k - grow]);
+    }
+    else if (new_n < old_n) {
+        size_t shrink = old_n - new_n;
+        for (size_t k = at + new_n; k + shrink < v.size(); ++k)
+            move_token(v[k], v[k + shrink]);
+        v.resize(v.size() - shrink);
+    }
+    for (size_t k = 0; k < new_n; ++k) move_token(v[at + k], repl[k]);
+}
+
+// Any #if/#ifdef/#ifndef/#elif/#else/#endif among the lines in [b, e)?
+static bool has_conditional(const std::string& s, size_t b, size_t e) {
+    const char* p = s.data() + b;
+    const char* end = s.data() + e;
+    for (const char* eol; p < end; p = eol + 1) {
+        eol = (const char*)std::memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        const char* rest;
+        if (cond_directive(p, eol, rest) != NotCond) return true;
+    }
+    return false;
+}
+
+// A line that preprocess_physical_lines would merge or split: it ends in a
+// backslash continuation or holds a CR that is not part of its CRLF.
+static bool irregular_line(const std::string& s, size_t b, size_t e) {
+    bool has_nl = e < s.size();
+    for (size_t j = b; j < e; ++j)
+        if (s[j] == '\r' && !(j + 1 == e && has_nl)) return true;
+    if (!has_nl || e == b) return false;
+    size_t last = s[e - 1] == '\r' ? e - 1 : e;
+    return last > b && s[last - 1] == '\\';
+}
+
+static void split_output_lines(const std::string& s,
+    std::vector<std::string>& out) {
+    out.clear();
+    size_t b = 0;
+    while (b < s.size()) {
+        size_t e = s.find('\n', b);
+        if (e == std::string::npos) e = s.size();
+        out.push_back(s.substr(b, e - b));
+        b = e + 1;
+    }
+}
+
+// 'before' output lines precede the window whose text went from old_text to
+// new_text; trim what the two share at either end.
+static void make_line_diff(int before, const std::string& old_text,
+    const std::string& new_text, LineDiff& diff) {
+    std::vector<std::string> a, b;
+    split_output_lines(old_text, a);
+    split_output_lines(new_text, b);
+    size_t head = 0;
+    while (head < a.size() && head < b.size() && a[head] == b[head]) ++head;
+    size_t tail = 0;
+    while (tail < a.size() - head && tail < b.size() - head &&
+        a[a.size() - 1 - tail] == b[b.size() - 1 - tail])
+        ++tail;
+    diff.first = before + (int)head;
+    diff.removed = (int)(a.size() - head - tail);
+    diff.lines.assign(b.begin() + head, b.end() - tail);
+}
+
+// Text the conversion put into a source line: 'label' goes before source
+// column 'col' (1-based, in bytes).
+struct Hint {
+    int col;
+    std::string label;
+};
+
+// Compare a line's source tokens with its converted tokens. Passes only
+// insert tokens, turn '.' into '->' and drop enum ';', so a greedy walk
+// pairs them up by offset. Each run of inserted or rewritten tokens becomes
+// one hint: after the rewritten token if the run has one, otherwise before
+// the next source token on the line (after the last one at the line's end).
+// 'bol' is the offset where the line starts.
+static void collect_hints(const Token* src, size_t n, size_t bol,
+    const std::vector<Token>& line, std::vector<Hint>& out) {
+    out.clear();
+    size_t o = 0;
+    size_t run_end = 0;  // offset after the last rewritten token of the run
+    std::string label;
+    for (size_t k = 0; k <= line.size(); ++k) {
+        bool same = false, rewritten = false;
+        if (k < line.size()) {
+            const Token& f = line[k];
+            if (o + 1 < n && src[o].type == Token::Punct &&
+                src[o].text == ";" && f.text != ";" &&
+                f.text == src[o + 1].text && f.pos == src[o + 1].pos)
+                ++o;  // a dropped enum ';'
+            if (o < n && f.pos == src[o].pos) {
+                same = f.text == src[o].text;
+                rewritten = !same && src[o].text == "." && f.text == "->";
+            }
+            if (!same) label += f.text;
+            if (rewritten) run_end = src[o].pos + src[o].text.size();
+        }
+        if (!same && k < line.size()) {
+            if (rewritten) ++o;
             continue;
         }
-        std::fprintf(stderr, "Wrote %s\n", outpath.c_str());
+        if (!label.empty()) {
+            size_t at = bol;
+            if (run_end)
+                at = run_end;
+            else if (k < line.size())
+                at = src[o].pos;
+            else if (o > 0)
+                at = src[o - 1].pos + src[o - 1].text.size();
+            Hint h;
+            h.col = at > bol ? (int)(at - bol) + 1 : 1;
+            h.label.swap(label);
+            out.push_back(h);
+            run_end = 0;
+        }
+        if (same) ++o;
+    }
+}
+
+struct IncrementalDoc {
+    std::string text;
+    int full_rebuilds, partial_edits;  // counters, for reports
+
+    IncrementalDoc()
+        : full_rebuilds(0), partial_edits(0), irregular(0), pre_size(0),
+        clean_scopes(0) {}
+
+    // Convert 'src' from scratch; 'types' is known_types before this file.
+    void open(const std::string& src, const std::set<std::string>& types) {
+        text = src;
+        initial_types = types;
+        rebuild();
+    }
+
+    std::string output() const {
+        std::string out;
+        for (size_t l = 1; l < out_lines.size(); ++l) out += out_lines[l];
+        return out;
+    }
+
+    int line_count() const { return (int)line_start.size() - 1; }
+
+    // Byte offset of 1-based line 'l' in 'text' (text.size() past the end).
+    size_t line_offset(int l) const {
+        return l >= 1 && l <= line_count() ? line_start[l] : text.size();
+    }
+
+    // What the conversion adds to source line 'l', left to right.
+    const std::vector<Hint>& hints(int l) const { return out_hints[l]; }
+
+    // Forbidden '->' and the like, by line; the document still converts.
+    const std::vector<LexError>& errors() const { return lex_errors; }
+
+    // The type names this document adds to known_types.
+    void added_types(std::set<std::string>& out) const {
+        out.clear();
+        for (size_t k = 0; k < types.size(); ++k) out.insert(types[k].name);
+    }
+
+    // known_types before this file became 'types': analyze again, keeping
+    // the tokens. Returns false (and does nothing) if they are unchanged.
+    bool retype(const std::set<std::string>& before) {
+        if (before == initial_types) return false;
+        initial_types = before;
+        ++full_rebuilds;
+        reanalyze_all();
+        return true;
+    }
+
+    // Replace 'removed' bytes at 'offset' with 'inserted'. Returns true when
+    // the edit took the incremental path; 'diff' is filled either way.
+    bool edit(size_t offset, size_t removed, const std::string& inserted,
+        LineDiff& diff) {
+        if (offset > text.size()) offset = text.size();
+        if (removed > text.size() - offset) removed = text.size() - offset;
+        // a '\r' can make or join line breaks (a lone CR ends a line, CRLF
+        // is one break): renumber everything
+        if (inserted.find('\r') != std::string::npos ||
+            (offset > 0 && text[offset - 1] == '\r') ||
+            text.find('\r', offset) < offset + removed) {
+            std::string old_all = output();
+            text.replace(offset, removed, inserted);
+            ++full_rebuilds;
+            rebuild();
+            make_line_diff(0, old_all, output(), diff);
+            return false;
+        }
+        const int l0 = line_of(offset), l1 = line_of(offset + removed);
+        const int old_n = l1 - l0 + 1;
+        const int new_n = old_n +
+            (int)std::count(inserted.begin(), inserted.end(), '\n') -
+            (l1 - l0);
+        const int delta = new_n - old_n;
+
+        // old state, read before anything moves
+        size_t b0 = first_token_of(l0), e0 = first_token_of(l1 + 1);
+        const size_t pb = pre_offset(l0), pe = pre_offset(l1 + 1);
+        size_t ob = 0, cb = 0;
+        // a conditional directive moves branch bounds: lex the whole file
+        bool lexable = irregular == 0 && line_span[l0] == 0 &&
+            (l1 == line_count() || line_span[l1 + 1] == 0) &&
+            !has_conditional(text, line_start[l0], line_end(l1));
+        bool scoped = lexable && find_scope(b0, e0, ob, cb);
+        int before = 0;
+        std::string old_window, old_edited;
+        if (scoped) {
+            for (int l = 1; l < tok_line(ob); ++l) before += out_nl[l];
+            for (int l = tok_line(ob); l <= tok_line(cb); ++l)
+                old_window += out_lines[l];
+        }
+        for (int l = l0; l <= l1; ++l) old_edited += out_lines[l];
+
+        // text and per-line tables
+        text.replace(offset, removed, inserted);
+        for (int l = l0; l <= l1; ++l) irregular -= line_bad[l];
+        resize_gap(line_start, l0, old_n, new_n);
+        resize_gap(line_bad, l0, old_n, new_n);
+        resize_gap(line_span, l0, old_n, new_n);
+        resize_gap(summaries, l0, old_n, new_n);
+        resize_gap(out_lines, l0, old_n, new_n);
+        resize_gap(out_nl, l0, old_n, new_n);
+        resize_gap(out_hints, l0, old_n, new_n);
+        // size_t wrap-around makes this a subtraction when text shrank
+        for (size_t l = l0 + new_n; l < line_start.size(); ++l)
+            line_start[l] += inserted.size() - removed;
+        for (int l = l0 + 1; l < l0 + new_n; ++l)
+            line_start[l] = text.find('\n', line_start[l - 1]) + 1;
+        const int l1n = l0 + new_n - 1;
+        for (int l = l0; l <= l1n; ++l) {
+            line_bad[l] = irregular_line(text, line_start[l], line_end(l));
+            irregular += line_bad[l];
+            out_lines[l].clear();
+            out_nl[l] = 0;
+        }
+
+        // re-lex the touched lines on their own; "\n\n" makes a comment or
+        // string left open at the end show up as a span past the segment
+        std::vector<Token> seg;
+        std::vector<LineSummary> seg_sum;
+        std::vector<int> spans;
+        std::vector<LexError> seg_errors;
+        std::string seg_text;
+        lexable = lexable && irregular == 0 &&
+            !has_conditional(text, line_start[l0], line_end(l1n));
+        if (lexable) {
+            size_t sb = line_start[l0];
+            size_t se = l1n < line_count() ? line_start[l1n + 1] : text.size();
+            seg_text = preprocess_physical_lines(text.substr(sb, se - sb));
+            seg_text += "\n\n";
+            lex(seg_text, seg, seg_sum, true, 0, &spans, &seg_errors);
+            seg_text.resize(seg_text.size() - 2);
+        }
+        if (!lexable || (!spans.empty() && spans.back() > new_n)) {
+            std::string old_all = old_output(l0, l1n, old_edited);
+            ++full_rebuilds;
+            rebuild();
+            make_line_diff(0, old_all, output(), diff);
+            return false;
+        }
+        seg_sum.resize(new_n + 1);
+        for (int l = 0; l < new_n; ++l) {
+            summaries[l0 + l] = seg_sum[l + 1];
+            line_span[l0 + l] = 0;
+        }
+        for (size_t k = 0; k < spans.size(); ++k)
+            line_span[l0 + spans[k] - 1] = 1;
+        splice_errors(l0, l1, delta, seg_errors);
+
+        // offsets in the folded text: lines [l0, l1] were [pb, pe) there
+        const size_t pre_delta = seg_text.size() - (pe - pb);  // may wrap
+        LineIndex seg_lines;
+        seg_lines.build(seg_text);
+        resize_gap(pre_lines.starts, l0, old_n, new_n);
+        for (int k = 1; k < new_n; ++k)
+            pre_lines.starts[l0 + k] = pb + seg_lines.starts[k + 1];
+        for (size_t l = l0 + new_n; l < pre_lines.starts.size(); ++l)
+            pre_lines.starts[l] += pre_delta;
+        pre_size += pre_delta;
+
+        edited_types.clear();
+        std::vector<TypeEvent> kept;
+        for (size_t k = 0; k < types.size(); ++k) {
+            if (types[k].pos >= pb && types[k].pos < pe) {
+                edited_types.insert(types[k].name);
+                continue;
+            }
+            kept.push_back(types[k]);
+            if (kept.back().pos >= pe) kept.back().pos += pre_delta;
+        }
+        types.swap(kept);
+
+        for (size_t k = 0; k < seg.size(); ++k) seg[k].pos += pb;
+        size_t seg_n = seg.size();
+        splice_tokens(toks, b0, e0 - b0, seg);
+        for (size_t k = b0 + seg_n; k < toks.size(); ++k)
+            toks[k].pos += pre_delta;
+
+        if (scoped && reanalyze_scope(ob, cb + seg_n - (e0 - b0))) {
+            ++partial_edits;
+            size_t cb_new = cb + seg_n - (e0 - b0);
+            emit_window(tok_line(ob), tok_line(cb_new));
+            std::string new_window;
+            for (int l = tok_line(ob); l <= tok_line(cb_new); ++l)
+                new_window += out_lines[l];
+            make_line_diff(before, old_window, new_window, diff);
+            return true;
+        }
+        std::string old_all = old_output(l0, l1n, old_edited);
+        ++full_rebuilds;
+        reanalyze_all();
+        make_line_diff(0, old_all, output(), diff);
+        return false;
+    }
+
+private:
+    std::set<std::string> initial_types;
+    std::vector<size_t> line_start;        // [line] byte offset in 'text';
+                                           // '\n' and lone '\r' end lines
+    std::vector<unsigned char> line_bad;   // [line] irregular_line()
+    std::vector<unsigned char> line_span;  // [line] opens inside a
+                                           // comment, string literal or
+                                           // skipped #if branch
+    int irregular;                         // number of line_bad lines
+    std::vector<Token> toks;  // analyzed, before the token passes
+    LineIndex pre_lines;      // lines of the folded text the tokens index
+    size_t pre_size;          // ...and its length
+    std::vector<LineSummary> summaries;  // [line]
+    std::vector<Scope> scopes;
+    std::vector<std::map<std::string, VarInfo> > scope_vars;
+    std::map<int, std::vector<Param> > scope_params;  // by scope id
+    std::vector<TypeEvent> types;  // names this document added
+    std::set<std::string> edited_types;  // ...whose event was on edited lines
+    size_t clean_scopes;  // scopes.size() after the last full analysis
+    std::vector<std::string> out_lines;  // [line] converted text
+    std::vector<int> out_nl;             // [line] newlines in out_lines
+    std::vector<std::vector<Hint> > out_hints;  // [line]
+    std::vector<LexError> lex_errors;           // in line order
+
+    int line_of(size_t offset) const {
+        return (int)(std::upper_bound(line_start.begin() + 1,
+            line_start.end(), offset) - line_start.begin()) - 1;
+    }
+
+    size_t line_end(int l) const {  // offset of the line's '\n' (or end)
+        return l < line_count() ? line_start[l + 1] - 1 : text.size();
+    }
+
+    size_t pre_offset(int l) const {
+        return l >= 1 && l <= pre_lines.count() ? pre_lines.starts[l]
+                                                : pre_size;
+    }
+
+    int tok_line(size_t k) const {
+        return pre_lines.line_of(token_last(toks[k]));
+    }
+
+    size_t first_token_of(int line) const {
+        const size_t start = pre_offset(line);
+        size_t lo = 0, hi = toks.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (token_last(toks[mid]) < start)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // The output before the edit: untouched lines still hold it, the edited
+    // lines' old text was saved.
+    std::string old_output(int l0, int l1n, const std::string& edited) const {
+        std::string out;
+        for (int l = 1; l < l0; ++l) out += out_lines[l];
+        out += edited;
+        for (int l = l1n + 1; l <= line_count(); ++l) out += out_lines[l];
+        return out;
+    }
+
+    // Innermost scope whose '{' is before token b0 and whose '}' is at or
+    // after e0 (old token indices). Brace lists nested in an initializer
+    // body are part of its one scope, so only the outermost list counts.
+    bool find_scope(size_t b0, size_t e0, size_t& ob, size_t& cb) const {
+        size_t k = b0;
+        for (;;) {
+            int depth = 0;
+            bool found = false;
+            while (!found && k > 0) {
+                --k;
+                if (toks[k].type != Token::Punct) continue;
+                if (toks[k].text == "}")
+                    ++depth;
+                else if (toks[k].text == "{" && depth-- == 0)
+                    found = true;
+            }
+            if (!found) return false;
+            size_t close = find_matching_brace(toks, k);
+            if (close == toks.size()) return false;
+            int sid = toks[close].scope_id;
+            if (close >= e0 && (scopes[sid].kind != "Initializer" ||
+                toks[k].scope_id != sid)) {
+                ob = k;
+                cb = close;
+                return true;
+            }
+        }
+    }
+
+    void rebuild() {
+        line_start.assign(2, 0);
+        for (size_t i = text.find_first_of("\r\n"); i != std::string::npos;
+            i = text.find_first_of("\r\n", i + 1))
+            if (text[i] == '\n' || i + 1 == text.size() || text[i + 1] != '\n')
+                line_start.push_back(i + 1);
+        const int n = line_count();
+        line_bad.assign(n + 1, 0);
+        irregular = 0;
+        for (int l = 1; l <= n; ++l) {
+            line_bad[l] = irregular_line(text, line_start[l], line_end(l));
+            irregular += line_bad[l];
+        }
+
+        std::string pre = preprocess_physical_lines(text);
+        pre_lines.build(pre);
+        pre_size = pre.size();
+        std::vector<int> spans;
+        toks.clear();
+        summaries.clear();
+        lex_errors.clear();
+        lex(pre, toks, summaries, true, 0, &spans, &lex_errors);
+        summaries.resize(n + 1);
+        line_span.assign(n + 1, 0);
+        for (size_t k = 0; k < spans.size(); ++k)
+            if (spans[k] <= n) line_span[spans[k]] = 1;
+        reanalyze_all();
+    }
+
+    void reanalyze_all() {
+        std::set<std::string> known = initial_types;
+        types.clear();
+        AnalyzeState st;
+        st.type_log = &types;
+        analyze_scopes_and_vars(toks, scopes, scope_vars, known, 0, &st);
+        scope_params.clear();
+        note_params(st);
+        clean_scopes = scopes.size();
+        emit_window(1, line_count());
+    }
+
+    // Old lines [l0, l1] were re-lexed with 'seg' (segment line numbers).
+    void splice_errors(int l0, int l1, int delta,
+        const std::vector<LexError>& seg) {
+        std::vector<LexError> merged;
+        size_t k = 0;
+        for (; k < lex_errors.size() && lex_errors[k].line < l0; ++k)
+            merged.push_back(lex_errors[k]);
+        for (size_t s = 0; s < seg.size(); ++s) {
+            merged.push_back(seg[s]);
+            merged.back().line += l0 - 1;
+        }
+        for (; k < lex_errors.size(); ++k) {
+            if (lex_errors[k].line <= l1) continue;
+            merged.push_back(lex_errors[k]);
+            merged.back().line += delta;
+        }
+        lex_errors.swap(merged);
+    }
+
+    void note_params(const AnalyzeState& st) {
+        std::map<int, std::vector<Param> >::const_iterator it;
+        for (it = st.params_at_lbrace.begin();
+            it != st.params_at_lbrace.end(); ++it)
+            if ((size_t)it->first + 1 < toks.size())
+                scope_params[toks[it->first + 1].scope_id] = it->second;
+    }
+
+    // Re-run the analyzer over the body of the scope opened at 'ob' (its
+    // '}' is now at cb_new). False if that is not provably
+    // what a full analysis would do; the caller then re-analyzes it all.
+    bool reanalyze_scope(size_t ob, size_t cb_new) {
+        if (find_matching_brace(toks, ob) != cb_new) return false;
+        if (scopes.size() > 2 * clean_scopes + 256) return false;  // compact
+        // a typedef reads up to the next ';' or '}', possibly into the body
+        size_t head = ob;
+        while (head > 0 && !is_p(toks, (int)head - 1, ";") &&
+            !is_p(toks, (int)head - 1, "}")) {
+            if (is_kw(toks, (int)head - 1, "typedef")) return false;
+            --head;
+        }
+        // signature and declarator scans stop at balanced ')' / ']'
+        int paren = 0, bracket = 0;
+        for (size_t k = head; k < cb_new; ++k) {
+            if (toks[k].type != Token::Punct) continue;
+            const std::string& p = toks[k].text;
+            if (p == "(") ++paren;
+            else if (p == ")" && --paren < 0) return false;
+            else if (p == "[") ++bracket;
+            else if (p == "]" && --bracket < 0) return false;
+            else if (k == ob && (paren || bracket)) return false;
+        }
+        if (paren || bracket) return false;
+
+        int sid = toks[cb_new].scope_id;
+        if (scopes[sid].kind == "Initializer") {
+            // the analyzer skips the body whole: only scope ids to restore
+            if (!edited_types.empty()) return false;
+            for (size_t k = ob + 1; k < cb_new; ++k) toks[k].scope_id = sid;
+            return true;
+        }
+        const Token& open = toks[ob];
+        std::set<std::string> known = initial_types;
+        std::set<std::string> old_names = edited_types;
+        std::vector<TypeEvent> kept, after;
+        for (size_t k = 0; k < types.size(); ++k) {
+            const TypeEvent& ev = types[k];
+            if (ev.pos < open.pos) {
+                known.insert(ev.name);
+                kept.push_back(ev);
+            }
+            else if (ev.pos <= toks[cb_new].pos)
+                old_names.insert(ev.name);
+            else
+                after.push_back(ev);
+        }
+
+        scope_vars[sid].clear();
+        std::map<int, std::vector<Param> >::const_iterator pit =
+            scope_params.find(sid);
+        if (pit != scope_params.end())
+            declare_params(scope_vars[sid], pit->second);
+        std::vector<TypeEvent> added;
+        AnalyzeState st;
+        st.cur = sid;
+        st.type_log = &added;
+        analyze_range(toks, ob + 1, cb_new + 1, st, scopes, scope_vars, known,
+            0);
+        if (st.cur != scopes[sid].parent) return false;
+        std::set<std::string> new_names;
+        for (size_t k = 0; k < added.size(); ++k)
+            new_names.insert(added[k].name);
+        if (new_names != old_names) return false;
+        note_params(st);
+        kept.insert(kept.end(), added.begin(), added.end());
+        kept.insert(kept.end(), after.begin(), after.end());
+        types.swap(kept);
+        return true;
+    }
+
+    // Run the token passes and the line rewrite for lines [first, last].
+    void emit_window(int first, int last) {
+        size_t b = first_token_of(first), e = first_token_of(last + 1);
+        std::vector<Token> work(toks.begin() + b, toks.begin() + e);
+        // lookahead for the ';' after a closing '}' on the last line
+        for (size_t k = e; k < toks.size(); ++k) {
+            work.push_back(toks[k]);
+            const Token& t = toks[k];
+            bool enum_semi = t.type == Token::Punct && t.text == ";" &&
+                scopes[t.scope_id].kind == "Enum";
+            if (t.type != Token::Preprocessor && !enum_semi) break;
+        }
+        run_token_passes<DialectFull>(work, scopes);
+
+        std::vector<std::vector<Token> > lines;
+        std::vector<int> line_scope, line_no;
+        split_into_lines(work, pre_lines, summaries, lines, line_scope,
+            line_no);
+        out_lines.resize(line_count() + 1);
+        out_nl.resize(line_count() + 1);
+        out_hints.resize(line_count() + 1);
+        for (int l = first; l <= last; ++l) {
+            out_lines[l].clear();
+            out_nl[l] = 0;
+            out_hints[l].clear();
+        }
+        for (size_t li = 0; li < lines.size(); ++li) {
+            int l = line_no[li];
+            if (l < first || l > last) continue;
+            convert_line<DialectFull>(lines[li], line_scope[li], summaries[l],
+                scopes, scope_vars, out_lines[l]);
+            out_nl[l] = (int)std::count(out_lines[l].begin(),
+                out_lines[l].end(), '\n');
+            size_t sb = first_token_of(l);
+            collect_hints(&toks[0] + sb, first_token_of(l + 1) - sb,
+                pre_offset(l), lines[li], out_hints[l]);
+        }
+    }
+};
+
+// ----- reverse conversion (C to C+) -----
+// --to-cplus=DIR turns existing C/C++98 sources into C+, so real code bases
+// can serve as benchmark and round-trip corpora: every ';' that ends a line
+// is dropped and every '->' becomes '.' ('(*pps)->m', the converter's form
+// for a pointer to pointer, goes back to 'pps.m'). Each edit is proven by
+// converting back. At the first token where the result differs from the
+// original, the ';' edit there (or the nearest earlier one, on that line
+// or the line before) is undone and the file converted again, until the
+// round trip gives back the original tokens. A '->' cannot be given back.
+// Spacing and comments are not compared (the lexer drops comments; the
+// converter re-spaces lines). A difference no edit explains leaves the
+// file lossy from that line on; it is still written with the edits kept
+// so far.
+struct ReverseEdit {
+    size_t token;     // index into the original's tokens
+    size_t pos, end;  // bytes [pos, end) of the original are replaced
+    const char* with;
+    int line;
+    bool arrow;  // part of a '->' rewrite, which cannot be undone
+    bool active;
+};
+
+struct ReverseResult {
+    std::string cplus;
+    size_t edits;    // rewrites found
+    size_t undone;   // ';' the round trip needed back
+    size_t rounds;   // conversions run
+    int lossy_line;  // first original line that does not round-trip, or 0
+    std::string original, back;  // that line, and where it came back
+};
+
+static std::string line_at(const std::string& s, const LineIndex& index,
+    int line) {
+    size_t b = index.starts[line];
+    size_t e = s.find('\n', b);
+    return s.substr(b, e == std::string::npos ? std::string::npos : e - b);
+}
+
+static std::string apply_reverse_edits(const std::string& src,
+    const std::vector<ReverseEdit>& edits) {
+    std::string out;
+    out.reserve(src.size());
+    size_t done = 0;
+    for (size_t i = 0; i < edits.size(); ++i) {
+        const ReverseEdit& e = edits[i];
+        if (!e.active) continue;
+        out.append(src, done, e.pos - done);
+        out += e.with;
+        done = e.end;
+    }
+    out.append(src, done, std::string::npos);
+    return out;
+}
+
+// Index of the first token where 'got' differs from 'want'; npos if none.
+static size_t first_token_difference(const std::vector<Token>& want,
+    const std::vector<Token>& got) {
+    size_t n = std::min(want.size(), got.size());
+    for (size_t i = 0; i < n; ++i)
+        if (want[i].text != got[i].text) return i;
+    return want.size() == got.size() ? std::string::npos : n;
+}
+
+// 'known_types' receives the names the file defines, as in a batch run.
+static void to_cplus(const std::string& text, const DialectEntry* dialect,
+    std::set<std::string>& known_types, ReverseResult& r) {
+    std::string src = preprocess_physical_lines(text);
+    std::vector<Token> want, got;
+    std::vector<LineSummary> summaries;
+    lex(src, want, summaries, false, 0);
+    LineIndex index;
+    index.build(src);
+
+    std::vector<ReverseEdit> edits;
+    for (size_t i = 0; i < want.size(); ++i) {
+        const Token& t = want[i];
+        ReverseEdit e;
+        e.token = i;
+        e.pos = t.pos;
+        e.end = t.pos + t.text.size();
+        e.with = "";
+        e.line = index.line_of(t.pos);
+        e.arrow = t.type == Token::Operator && t.text == "->";
+        e.active = true;
+        if (e.arrow) {
+            // '( * ... * name ) ->': drop the parentheses and the stars
+            size_t b = i;
+            if (b >= 3 && want[b - 1].text == ")" &&
+                want[b - 2].type == Token::Identifier) {
+                b -= 2;
+                while (b > 0 && want[b - 1].text == "*") --b;
+                if (b + 2 < i && b > 0 && want[b - 1].text == "(") {
+                    ReverseEdit w = e;
+                    w.token = b - 1;
+                    w.pos = want[b - 1].pos;
+                    w.end = want[i - 2].pos;
+                    w.line = index.line_of(w.pos);
+                    edits.push_back(w);
+                    e.pos = want[i - 1].pos;
+                }
+            }
+            e.with = ".";
+            edits.push_back(e);
+        }
+        else if (t.type == Token::Punct && t.text == ";" &&
+            (i + 1 == want.size() || index.line_of(want[i + 1].pos) > e.line))
+            edits.push_back(e);
+    }
+
+    r.edits = edits.size();
+    r.undone = 0;
+    r.rounds = 0;
+    r.lossy_line = 0;
+    for (;;) {
+        r.cplus = apply_reverse_edits(src, edits);
+        std::set<std::string> kt = known_types;
+        std::string back;
+        dialect->convert(r.cplus, kt, back, 0, 0);
+        ++r.rounds;
+        got.clear();
+        summaries.clear();
+        lex(back, got, summaries, false, 0);
+        size_t k = first_token_difference(want, got);
+        bool settled = k == std::string::npos;
+        if (!settled) {
+            int line = want.empty()
+                ? 1
+                : index.line_of(want[std::min(k, want.size() - 1)].pos);
+            // C+ has no '->', so only a ';' can be given back
+            size_t e = edits.size();
+            while (e > 0 && edits[e - 1].token > k) --e;
+            while (e > 0 && edits[e - 1].line >= line - 1 &&
+                (edits[e - 1].arrow || !edits[e - 1].active))
+                --e;
+            if (e > 0 && edits[e - 1].line >= line - 1) {
+                edits[e - 1].active = false;
+                ++r.undone;
+                continue;
+            }
+            r.lossy_line = line;
+            r.original = line_at(src, index, line);
+            LineIndex back_index;
+            back_index.build(back);
+            r.back = got.empty() ? std::string() : line_at(back, back_index,
+                back_index.line_of(got[std::min(k, got.size() - 1)].pos));
+        }
+        known_types.swap(kt);
+        return;
+    }
+}
+
+static void print_reverse_result(const char* mode, const std::string& name,
+    const ReverseResult& r) {
+    std::fprintf(stderr, "%s: %-20s %6lu edits, %5lu undone, %4lu "
+        "conversion(s)%s",
+        mode, name.c_str(), (unsigned long)r.edits, (unsigned long)r.undone,
+        (unsigned long)r.rounds, r.lossy_line ? "" : "\n");
+    if (!r.lossy_line) return;
+    std::fprintf(stderr, "; LOSSY from line %d\n", r.lossy_line);
+    std::fprintf(stderr, "  original:       %s\n", r.original.c_str());
+    std::fprintf(stderr, "  converted back: %s\n", r.back.c_str());
+}
+
+// --to-cplus=DIR: writes DIR/<name>.cp for every input, in batch order.
+static int to_cplus_files(const char* dir,
+    const std::vector<const char*>& inputs, const DialectEntry* dialect) {
+    std::set<std::string> known_types = builtin_types();
+    bool lossless = true;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::string text;
+        if (!read_file(inputs[i], text)) {
+            std::fprintf(stderr, "Error: cannot read: %s\n", inputs[i]);
+            return 1;
+        }
+        ReverseResult r;
+        to_cplus(text, dialect, known_types, r);
+        std::string base = inputs[i];
+        std::string::size_type sep = base.find_last_of("/\\");
+        if (sep != std::string::npos) base.erase(0, sep + 1);
+        std::string outpath =
+            std::string(dir) + "/" + replace_ext(base, ".cp");
+        if (!write_text_file(outpath, r.cplus)) {
+            std::fprintf(stderr, "Error: cannot write: %s\n",
+                outpath.c_str());
+            return 1;
+        }
+        print_reverse_result("to-cplus", outpath, r);
+        if (r.lossy_line) lossless = false;
+    }
+    return lossless ? 0 : 1;
+}
+
+// ----- pack archives -----
+// --pack=FILE writes every converted file into one archive instead of one
+// file per input, so a build farm creates one inode per run. The archive is
+// written front to back in a single pass:
+//   header   one page: "CPLUSPK1", u32 version (1), u32 page size (4096)
+//   data     the files, each from a page boundary and zero-padded to the
+//            next, so one entry can be mapped or O_DIRECT-read on its own
+//   index    per file, sorted by name: u64 data offset, u64 size,
+//            u64 name offset (into the names), u64 name length
+//   names    the names, in index order, unterminated
+//   trailer  u64 index offset, u64 file count, "CPLUSIX1"
+// All integers are little-endian; offsets are from the start of the file.
+// PackReader maps an archive and looks files up by name without copying;
+// --unpack=FILE extracts it (under --unpack-dir=DIR, default '.'). Entries
+// are named by their path relative to the working directory, so a pack
+// can be extracted anywhere; a name that is absolute or climbs out with
+// '..' is refused both when packing and when extracting.
+static const char kPackMagic[8] = { 'C', 'P', 'L', 'U', 'S', 'P', 'K', '1' };
+static const char kPackIndexMagic[8] = { 'C', 'P', 'L', 'U', 'S', 'I', 'X',
+    '1' };
+enum { kPackPage = 4096, kPackEntryBytes = 32, kPackTrailerBytes = 24 };
+
+static void put_u32(std::string& out, unsigned v) {
+    for (int b = 0; b < 4; ++b) out += (char)((v >> (8 * b)) & 0xFF);
+}
+
+// 'path' with '.' and 'x/..' segments folded, '/'-separated; false if it
+// is absolute or leads out of its root.
+static bool fold_relative(const std::string& path, std::string& out) {
+    out.clear();
+    if (path.empty() || path[0] == '/' || path[0] == '\\' ||
+        (path.size() >= 2 && path[1] == ':'))
+        return false;
+    std::vector<std::string> parts;
+    for (size_t b = 0; b <= path.size();) {
+        size_t e = path.find_first_of("/\\", b);
+        if (e == std::string::npos) e = path.size();
+        std::string seg = path.substr(b, e - b);
+        if (seg == "..") {
+            if (parts.empty()) return false;
+            parts.pop_back();
+        }
+        else if (!seg.empty() && seg != ".")
+            parts.push_back(seg);
+        b = e + 1;
+    }
+    for (size_t k = 0; k < parts.size(); ++k)
+        out += (k ? "/" : "") + parts[k];
+    return !out.empty();
+}
+
+// The name an output path is stored under in a pack: relative to the
+// working directory.
+static bool pack_name(const std::string& path, std::string& name) {
+    std::string rel = path;
+#ifdef CPLUS_POSIX
+    char cwd[4096];
+    if (!rel.empty() && rel[0] == '/' && ::getcwd(cwd, sizeof(cwd))) {
+        size_t n = std::strlen(cwd);
+        if (n == 1)
+            rel.erase(0, 1);
+        else if (rel.compare(0, n, cwd) == 0 && rel.size() > n &&
+            rel[n] == '/')
+            rel.erase(0, n + 1);
+    }
+#endif
+    return fold_relative(rel, name);
+}
+
+// Create the directories leading to 'path' (POSIX only; elsewhere they
+// must exist).
+static void make_parent_dirs(const std::string& path) {
+#ifdef CPLUS_POSIX
+    for (size_t at = path.find('/', 1); at != std::string::npos;
+        at = path.find('/', at + 1))
+        ::mkdir(path.substr(0, at).c_str(), 0777);  // EEXIST is fine
+#else
+    (void)path;
+#endif
+}
+
+static void put_u64(std::string& out, unsigned long long v) {
+    for (int b = 0; b < 8; ++b) out += (char)((v >> (8 * b)) & 0xFF);
+}
+
+static unsigned long long get_u64(const char* p) {
+    unsigned long long v = 0;
+    for (int b = 7; b >= 0; --b) v = (v << 8) | (unsigned char)p[b];
+    return v;
+}
+
+struct PackEntry {
+    std::string name;
+    unsigned long long offset, size;
+};
+
+static bool pack_entry_less(const PackEntry& a, const PackEntry& b) {
+    return a.name < b.name;
+}
+
+struct PackWriter {
+    PackWriter() : at(0), failed(false) {
+#ifdef CPLUS_POSIX
+        fd = -1;
+#else
+        f = 0;
+#endif
+    }
+
+    bool open(const char* path) {
+#ifdef CPLUS_POSIX
+        fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) return false;
+#else
+        f = std::fopen(path, "wb");
+        if (!f) return false;
+#endif
+        std::string header(kPackMagic, 8);
+        put_u32(header, 1);
+        put_u32(header, kPackPage);
+        header.resize(kPackPage, '\0');
+        return put(header.data(), header.size());
+    }
+
+    // Append one file. A name added twice keeps only the later data.
+    bool add(const std::string& name, const std::string& data) {
+        static const char zeros[kPackPage] = { 0 };
+        PackEntry e;
+        e.name = name;
+        e.offset = at;
+        e.size = data.size();
+        entries.push_back(e);
+        size_t tail = data.size() % kPackPage;
+        return put(data.data(), data.size()) &&
+            (!tail || put(zeros, kPackPage - tail));
+    }
+
+    // Write the index and trailer and close; false if any write failed.
+    bool finish() {
+        std::stable_sort(entries.begin(), entries.end(), pack_entry_less);
+        std::vector<PackEntry> last;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (!last.empty() && last.back().name == entries[i].name)
+                last.back() = entries[i];
+            else
+                last.push_back(entries[i]);
+        }
+        unsigned long long index_at = at;
+        std::string index, names;
+        for (size_t i = 0; i < last.size(); ++i) {
+            put_u64(index, last[i].offset);
+            put_u64(index, last[i].size);
+            put_u64(index, names.size());
+            put_u64(index, last[i].name.size());
+            names += last[i].name;
+        }
+        index += names;
+        put_u64(index, index_at);
+        put_u64(index, last.size());
+        index.append(kPackIndexMagic, 8);
+        put(index.data(), index.size());
+#ifdef CPLUS_POSIX
+        if (::close(fd) != 0) failed = true;
+#else
+        if (std::fclose(f) != 0) failed = true;
+#endif
+        return !failed;
+    }
+
+private:
+    std::vector<PackEntry> entries;
+    unsigned long long at;  // bytes written so far
+    bool failed;
+#ifdef CPLUS_POSIX
+    int fd;
+#else
+    std::FILE* f;
+#endif
+
+    bool put(const char* data, size_t len) {
+        if (failed) return false;
+#ifdef CPLUS_POSIX
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = ::write(fd, data + done, len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                failed = true;
+                return false;
+            }
+            done += (size_t)n;
+        }
+#else
+        if (std::fwrite(data, 1, len, f) != len) {
+            failed = true;
+            return false;
+        }
+#endif
+        at += len;
+        return true;
+    }
+};
+
+// Read-only view of a pack. On POSIX the file is mapped, and data() points
+// into the mapping; elsewhere it is read into memory once.
+struct PackReader {
+    PackReader() : base(0), size(0), count(0), index(0), names(0) {}
+    ~PackReader() { close(); }
+
+    bool open(const char* path) {
+        close();
+#ifdef CPLUS_POSIX
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size < kPackPage) {
+            ::close(fd);
+            return false;
+        }
+        size = (size_t)st.st_size;
+        void* m = ::mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            size = 0;
+            return false;
+        }
+        base = (const char*)m;
+#else
+        if (!read_file(path, copy)) return false;
+        base = copy.data();
+        size = copy.size();
+#endif
+        if (validate()) return true;
+        close();
+        return false;
+    }
+
+    void close() {
+#ifdef CPLUS_POSIX
+        if (base) ::munmap((void*)base, size);
+#else
+        copy.clear();
+#endif
+        base = 0;
+        size = count = 0;
+    }
+
+    size_t files() const { return count; }
+
+    std::string name(size_t i) const {
+        const char* e = index + i * kPackEntryBytes;
+        return std::string(names + get_u64(e + 16), (size_t)get_u64(e + 24));
+    }
+
+    const char* data(size_t i, size_t& len) const {
+        const char* e = index + i * kPackEntryBytes;
+        len = (size_t)get_u64(e + 8);
+        return base + get_u64(e);
+    }
+
+    // Binary search by name; null if absent.
+    const char* find(const std::string& want, size_t& len) const {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            const char* e = index + mid * kPackEntryBytes;
+            size_t n = (size_t)get_u64(e + 24);
+            int c = std::memcmp(names + get_u64(e + 16), want.data(),
+                std::min(n, want.size()));
+            if (c == 0) c = n < want.size() ? -1 : n > want.size() ? 1 : 0;
+            if (c == 0) return data(mid, len);
+            if (c < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return 0;
+    }
+
+private:
+    const char* base;
+    size_t size, count;
+    const char* index;  // first entry
+    const char* names;
+#ifndef CPLUS_POSIX
+    std::string copy;
+#endif
+
+    PackReader(const PackReader&);  // owns a mapping: not copyable
+    PackReader& operator=(const PackReader&);
+
+    // Check the magics and that every offset stays inside the file.
+    bool validate() {
+        if (size < kPackPage + kPackTrailerBytes ||
+            std::memcmp(base, kPackMagic, 8) != 0 || base[8] != 1)
+            return false;
+        const char* t = base + size - kPackTrailerBytes;
+        if (std::memcmp(t + 16, kPackIndexMagic, 8) != 0) return false;
+        unsigned long long at = get_u64(t), n = get_u64(t + 8);
+        unsigned long long end = size - kPackTrailerBytes;
+        if (at < kPackPage || at > end || n > (end - at) / kPackEntryBytes)
+            return false;
+        index = base + at;
+        names = index + n * kPackEntryBytes;
+        unsigned long long names_len = end - (at + n * kPackEntryBytes);
+        for (unsigned long long i = 0; i < n; ++i) {
+            const char* e = index + i * kPackEntryBytes;
+            if (get_u64(e) > at || get_u64(e + 8) > at - get_u64(e) ||
+                get_u64(e + 16) > names_len ||
+                get_u64(e + 24) > names_len - get_u64(e + 16))
+                return false;
+        }
+        count = (size_t)n;
+        return true;
+    }
+};
+
+// Extract 'pack' (only the named files if 'only' is not empty).
+static int unpack(const char* pack, const std::vector<const char*>& only,
+    const char* dir) {
+    PackReader r;
+    if (!r.open(pack)) {
+        std::fprintf(stderr, "Error: not a readable pack: %s\n", pack);
+        return 1;
+    }
+    int exit_code = 0;
+    std::vector<std::string> names;
+    if (only.empty())
+        for (size_t i = 0; i < r.files(); ++i) names.push_back(r.name(i));
+    else
+        names.assign(only.begin(), only.end());
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::string name;
+        if (!fold_relative(names[i], name) ||
+            (only.empty() && name != names[i])) {
+            std::fprintf(stderr, "Error: unsafe name: %s\n",
+                names[i].c_str());
+            exit_code = 1;
+            continue;
+        }
+        size_t len = 0;
+        const char* p = r.find(name, len);
+        if (!p) {
+            std::fprintf(stderr, "Error: not in pack: %s\n", name.c_str());
+            exit_code = 1;
+            continue;
+        }
+        std::string path =
+            std::strcmp(dir, ".") == 0 ? name : std::string(dir) + "/" + name;
+        make_parent_dirs(path);
+        if (!write_text_file(path, std::string(p, len))) {
+            std::fprintf(stderr, "Error: cannot write: %s\n", path.c_str());
+            exit_code = 1;
+            continue;
+        }
+        std::fprintf(stderr, "Wrote %s\n", path.c_str());
+    }
+    return exit_code;
+}
+
+// ----- line maps -----
+// --line-map writes <out>.cpp.map next to each output (or into the pack):
+// for every output line, the line and column in the .cp file of its first
+// token, so compiler diagnostics on the .cpp map back without reconverting.
+//   header   "CPLUSLM1", u32 output lines, u32 blocks
+//   blocks   per 64 output lines: u32 line, u32 column (of the block's
+//            first line), u32 offset of the rest of the block in 'deltas'
+//   deltas   per other line: LEB128 zigzag line delta from the line before,
+//            LEB128 column
+// Output line n is in block (n - 1) / 64, so a lookup is one index and at
+// most 63 varint pairs; LineMapReader maps the file and decodes in place.
+static const char kLineMapMagic[8] = { 'C', 'P', 'L', 'U', 'S', 'L', 'M',
+    '1' };
+enum { kLineMapBlock = 64, kLineMapHeaderBytes = 16, kLineMapBlockBytes = 12 };
+
+static unsigned get_u32(const char* p) {
+    unsigned v = 0;
+    for (int b = 3; b >= 0; --b) v = (v << 8) | (unsigned char)p[b];
+    return v;
+}
+
+static void put_varint(std::string& out, unsigned v) {
+    for (; v >= 0x80; v >>= 7) out += (char)(v | 0x80);
+    out += (char)v;
+}
+
+// Next LEB128 value at 'p' (not past 'end'); false if truncated.
+static bool get_varint(const char*& p, const char* end, unsigned& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        unsigned char b = (unsigned char)*p++;
+        v |= (unsigned)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static void encode_line_map(const LineMap& m, std::string& out) {
+    const size_t n = m.line.size();
+    const size_t blocks = (n + kLineMapBlock - 1) / kLineMapBlock;
+    std::string deltas;
+    out.assign(kLineMapMagic, 8);
+    put_u32(out, (unsigned)n);
+    put_u32(out, (unsigned)blocks);
+    for (size_t b = 0; b < blocks; ++b) {
+        size_t k = b * kLineMapBlock;
+        put_u32(out, (unsigned)m.line[k]);
+        put_u32(out, (unsigned)m.col[k]);
+        put_u32(out, (unsigned)deltas.size());
+        size_t last = std::min(n, k + kLineMapBlock);
+        for (++k; k < last; ++k) {
+            int d = m.line[k] - m.line[k - 1];
+            put_varint(deltas,
+                d < 0 ? ((unsigned)-d << 1) - 1 : (unsigned)d << 1);
+            put_varint(deltas, (unsigned)m.col[k]);
+        }
+    }
+    out += deltas;
+}
+
+struct LineMapReader {
+    LineMapReader() : base(0), size(0), lines(0), deltas(0) {}
+    ~LineMapReader() { close(); }
+
+    bool open(const char* path) {
+        close();
+#ifdef CPLUS_POSIX
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size < kLineMapHeaderBytes) {
+            ::close(fd);
+            return false;
+        }
+        size = (size_t)st.st_size;
+        void* m = ::mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            size = 0;
+            return false;
+        }
+        base = (const char*)m;
+#else
+        if (!read_file(path, copy)) return false;
+        base = copy.data();
+        size = copy.size();
+#endif
+        if (validate()) return true;
+        close();
+        return false;
+    }
+
+    void close() {
+#ifdef CPLUS_POSIX
+        if (base) ::munmap((void*)base, size);
+#else
+        copy.clear();
+#endif
+        base = 0;
+        size = lines = 0;
+    }
+
+    size_t output_lines() const { return lines; }
+
+    // Source line and column of output line 'out_line' (1-based).
+    bool lookup(size_t out_line, int& line, int& col) const {
+        if (out_line < 1 || out_line > lines) return false;
+        size_t k = out_line - 1;
+        const char* b =
+            base + kLineMapHeaderBytes + k / kLineMapBlock * kLineMapBlockBytes;
+        line = (int)get_u32(b);
+        col = (int)get_u32(b + 4);
+        const char* p = deltas + get_u32(b + 8);
+        const char* end = base + size;
+        for (size_t i = 0; i < k % kLineMapBlock; ++i) {
+            unsigned d, c;
+            if (!get_varint(p, end, d) || !get_varint(p, end, c)) return false;
+            line += d & 1 ? -(int)((d + 1) >> 1) : (int)(d >> 1);
+            col = (int)c;
+        }
+        return true;
+    }
+
+private:
+    const char* base;
+    size_t size, lines;
+    const char* deltas;
+#ifndef CPLUS_POSIX
+    std::string copy;
+#endif
+
+    LineMapReader(const LineMapReader&);  // owns a mapping: not copyable
+    LineMapReader& operator=(const LineMapReader&);
+
+    // Check the magic and that the block table and offsets fit the file.
+    bool validate() {
+        if (size < kLineMapHeaderBytes ||
+            std::memcmp(base, kLineMapMagic, 8) != 0)
+            return false;
+        unsigned long long n = get_u32(base + 8), blocks = get_u32(base + 12);
+        if (blocks != (n + kLineMapBlock - 1) / kLineMapBlock ||
+            blocks > (size - kLineMapHeaderBytes) / kLineMapBlockBytes)
+            return false;
+        deltas = base + kLineMapHeaderBytes + blocks * kLineMapBlockBytes;
+        size_t deltas_len = size - (deltas - base);
+        for (unsigned long long b = 0; b < blocks; ++b)
+            if (get_u32(base + kLineMapHeaderBytes + b * kLineMapBlockBytes +
+                    8) > deltas_len)
+                return false;
+        lines = (size_t)n;
+        return true;
+    }
+};
+
+// One diagnostic line: each "<path>.cpp:LINE[:COL]" whose <path>.cpp.map
+// exists becomes "<path>.cp:LINE:COL". The column is the first token's
+// column plus the offset into the output line (outputs are re-spaced, so
+// past the first token it is approximate).
+static std::string remap_line(const std::string& s,
+    std::map<std::string, LineMapReader*>& maps) {
+    std::string out;
+    size_t done = 0;
+    for (size_t at = s.find(".cpp:"); at != std::string::npos;
+        at = s.find(".cpp:", at + 1)) {
+        size_t num = at + 5, e = num;
+        while (e < s.size() && std::isdigit((unsigned char)s[e])) ++e;
+        if (e == num) continue;
+        size_t start = at;
+        while (start > done && !std::isspace((unsigned char)s[start - 1]) &&
+            s[start - 1] != '(' && s[start - 1] != '\'' &&
+            s[start - 1] != '"')
+            --start;
+        std::string path = s.substr(start, at + 4 - start);
+        std::map<std::string, LineMapReader*>::iterator it = maps.find(path);
+        if (it == maps.end()) {
+            LineMapReader* r = new LineMapReader();
+            if (!r->open((path + ".map").c_str())) {
+                delete r;
+                r = 0;
+            }
+            it = maps.insert(std::make_pair(path, r)).first;
+        }
+        int line = 0, col = 0;
+        if (!it->second ||
+            !it->second->lookup(std::strtoul(s.c_str() + num, 0, 10), line,
+                col))
+            continue;
+        size_t ce = e;
+        if (e + 1 < s.size() && s[e] == ':' &&
+            std::isdigit((unsigned char)s[e + 1])) {
+            ce = e + 1;
+            while (ce < s.size() && std::isdigit((unsigned char)s[ce])) ++ce;
+            col += std::atoi(s.c_str() + e + 1) - 1;
+        }
+        char pos[32];
+        std::sprintf(pos, ":%d:%d", line, col);
+        out.append(s, done, at + 3 - done);  // "<path>.cp"
+        out += pos;
+        done = ce;
+        at = ce - 1;
+    }
+    out.append(s, done, std::string::npos);
+    return out;
+}
+
+// --remap: filter compiler output on stdin to stdout through remap_line.
+static int remap_stdio() {
+    std::map<std::string, LineMapReader*> maps;
+    std::string pending, out;
+    char chunk[65536];
+    bool eof = false;
+    while (!eof) {
+#ifdef CPLUS_POSIX
+        ssize_t n = ::read(0, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+#else
+        size_t n = std::fread(chunk, 1, sizeof(chunk), stdin);
+#endif
+        eof = n == 0;
+        pending.append(chunk, (size_t)n);
+        out.clear();
+        size_t b = 0;
+        for (size_t nl; (nl = pending.find('\n', b)) != std::string::npos;
+            b = nl + 1)
+            out += remap_line(pending.substr(b, nl + 1 - b), maps);
+        if (eof && b < pending.size()) {
+            out += remap_line(pending.substr(b), maps);
+            b = pending.size();
+        }
+        pending.erase(0, b);
+        if (!write_stdout(out)) break;
+    }
+    for (std::map<std::string, LineMapReader*>::iterator it = maps.begin();
+        it != maps.end(); ++it)
+        delete it->second;
+    return eof ? 0 : 1;
+}
+
+// ----- watch mode -----
+// --watch DIR converts every .cp under DIR once, then reconverts on inotify
+// events. Per file it keeps the type names the file adds to known_types and
+// the identifiers it mentions, so a refresh visits files in batch order and
+// reconverts a file only if it changed or mentions a type name whose
+// definition changed in an earlier file (later files never affect earlier
+// ones). known_types grows along the walk from the builtins by each file's
+// names, exactly what a batch run would have seen.
+// With the full dialect each file also keeps its IncrementalDoc: a save
+// becomes one edit (the bytes between the unchanged head and tail), which
+// re-lexes and re-analyzes only what it touches, and a change in an earlier
+// file's type names re-runs the analysis over the tokens it holds. Other
+// dialects convert the whole file again. A file with a '->' the dialect
+// forbids is reported and left unwritten; watching goes on.
+struct WatchedFile {
+    std::set<std::string> words;    // identifiers in the source
+    std::set<std::string> defines;  // names it added to known_types
+    IncrementalDoc doc;             // full dialect only
+    bool opened;                    // 'doc' holds the file
+    WatchedFile() : opened(false) {}
+};
+
+struct WatchState {
+    const DialectEntry* dialect;
+    std::set<std::string> builtins;
+    std::map<std::string, WatchedFile> files;  // by path: the batch order
+};
+
+static bool has_cp_ext(const char* name) {
+    size_t n = std::strlen(name);
+    return n > 3 && std::strcmp(name + n - 3, ".cp") == 0;
+}
+
+static void collect_words(const std::string& src, std::set<std::string>& out) {
+    out.clear();
+    for (size_t i = 0; i < src.size();) {
+        if (!isIdentStart(src[i])) {
+            // skip the tail of numbers like 0x1f so it is not an identifier
+            if (std::isdigit((unsigned char)src[i]))
+                while (i < src.size() && isIdentChar(src[i])) ++i;
+            else
+                ++i;
+            continue;
+        }
+        size_t b = i;
+        while (i < src.size() && isIdentChar(src[i])) ++i;
+        out.insert(src.substr(b, i - b));
+    }
+}
+
+static bool mentions_any(const std::set<std::string>& words,
+    const std::set<std::string>& names) {
+    const std::set<std::string>& small =
+        names.size() < words.size() ? names : words;
+    const std::set<std::string>& big = &small == &names ? words : names;
+    for (std::set<std::string>::const_iterator it = small.begin();
+        it != small.end(); ++it)
+        if (big.count(*it)) return true;
+    return false;
+}
+
+// Bring 'doc' to 'src' with one edit over the bytes that differ.
+static void watch_edit(IncrementalDoc& doc, const std::string& src) {
+    const std::string& old = doc.text;
+    size_t head = 0, a = old.size(), b = src.size();
+    while (head < a && head < b && old[head] == src[head]) ++head;
+    while (a > head && b > head && old[a - 1] == src[b - 1]) {
+        --a;
+        --b;
+    }
+    if (a == head && b == head) return;
+    LineDiff diff;
+    doc.edit(head, a - head, src.substr(head, b - head), diff);
+}
+
+// Convert 'path' as seen after 'known_types' and refresh its words/defines;
+// 'changed' collects the type names it stopped or started defining. On a
+// read or lex error the file keeps its last defines and is not written.
+static bool watch_convert(WatchState& w, const std::string& path,
+    WatchedFile& f, const std::set<std::string>& known_types,
+    std::set<std::string>& changed) {
+    std::string src;
+    if (!read_file(path.c_str(), src)) {
+        std::fprintf(stderr, "Error: cannot read: %s\n", path.c_str());
+        return false;
+    }
+    std::string outcpp;
+    std::set<std::string> defines;
+    LexError err;
+    bool lexed = true;
+    if (w.dialect == &kDialects[0]) {
+        if (!f.opened)
+            f.doc.open(src, known_types);
+        else {
+            f.doc.retype(known_types);
+            watch_edit(f.doc, src);
+        }
+        f.opened = true;
+        if (!f.doc.errors().empty()) {
+            err = f.doc.errors()[0];
+            lexed = false;
+        }
+        outcpp = f.doc.output();
+        f.doc.added_types(defines);
+    }
+    else {
+        // the whole file as one segment, as StreamConverter::finish would
+        std::set<std::string> types = known_types;
+        std::string pre = preprocess_physical_lines(src);
+        SegmentContext ctx;
+        ctx.emit_end = pre.size();
+        lexed = w.dialect->convert_segment(pre, types, ctx, outcpp, &err);
+        std::set_difference(types.begin(), types.end(),
+            known_types.begin(), known_types.end(),
+            std::inserter(defines, defines.begin()));
+    }
+    collect_words(src, f.words);
+    if (!lexed) {
+        std::fprintf(stderr,
+            "C+ error: %s: '->' is not allowed (line %d, col %d); not "
+            "written\n",
+            path.c_str(), err.line, err.col);
+        return false;
+    }
+
+    std::set_symmetric_difference(defines.begin(), defines.end(),
+        f.defines.begin(), f.defines.end(),
+        std::inserter(changed, changed.begin()));
+    f.defines.swap(defines);
+
+    std::string outpath = replace_ext(path, ".cpp");
+    if (!write_text_file(outpath, outcpp)) {
+        std::fprintf(stderr, "Error: cannot write: %s\n", outpath.c_str());
+        return false;
+    }
+    std::fprintf(stderr, "Wrote %s\n", outpath.c_str());
+    return true;
+}
+
+// One refresh: 'dirty' paths were written (new ones are added), 'removed'
+// paths are gone. Returns the number of files converted.
+static int watch_refresh(WatchState& w, const std::set<std::string>& dirty,
+    const std::set<std::string>& removed) {
+    for (std::set<std::string>::const_iterator it = dirty.begin();
+        it != dirty.end(); ++it)
+        w.files[*it];
+
+    std::set<std::string> known_types = w.builtins;
+    std::set<std::string> changed;
+    int converted = 0;
+    for (std::map<std::string, WatchedFile>::iterator it = w.files.begin();
+        it != w.files.end();) {
+        WatchedFile& f = it->second;
+        if (removed.count(it->first)) {
+            changed.insert(f.defines.begin(), f.defines.end());
+            w.files.erase(it++);
+            continue;
+        }
+        if (dirty.count(it->first) || mentions_any(f.words, changed)) {
+            watch_convert(w, it->first, f, known_types, changed);
+            ++converted;
+        }
+        known_types.insert(f.defines.begin(), f.defines.end());
+        ++it;
+    }
+    return converted;
+}
+
+#ifdef CPLUS_INOTIFY
+// Watch 'dir' and every directory below it; .cp files found go to 'found'.
+static void watch_tree(int fd, const std::string& dir,
+    std::map<int, std::string>& dirs, std::set<std::string>& found) {
+    int wd = ::inotify_add_watch(fd, dir.c_str(),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE);
+    if (wd < 0) {
+        std::fprintf(stderr, "Error: cannot watch: %s\n", dir.c_str());
+        return;
+    }
+    dirs[wd] = dir;
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) return;
+    while (struct dirent* e = ::readdir(d)) {
+        if (e->d_name[0] == '.') continue;
+        std::string path = dir + "/" + e->d_name;
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode))
+            watch_tree(fd, path, dirs, found);
+        else if (S_ISREG(st.st_mode) && has_cp_ext(e->d_name))
+            found.insert(path);
+    }
+    ::closedir(d);
+}
+#endif
+
+// Runs until killed; returns an exit code only on setup failure.
+static int watch_dir(const char* root, const DialectEntry* dialect) {
+#ifdef CPLUS_INOTIFY
+    int fd = ::inotify_init();
+    if (fd < 0) {
+        std::fprintf(stderr, "Error: inotify: %s\n", std::strerror(errno));
+        return 1;
+    }
+    std::string dir = root;
+    while (dir.size() > 1 && dir[dir.size() - 1] == '/')
+        dir.erase(dir.size() - 1);
+
+    WatchState w;
+    w.dialect = dialect;
+    w.builtins = builtin_types();
+    std::map<int, std::string> dirs;
+    std::set<std::string> dirty, removed;
+    watch_tree(fd, dir, dirs, dirty);
+    if (dirs.empty()) return 1;
+
+    double t0 = now_ns();
+    int n = watch_refresh(w, dirty, removed);
+    std::fprintf(stderr,
+        "watch: converted %d file(s) in %.3f ms; watching %s\n", n,
+        (now_ns() - t0) / 1e6, dir.c_str());
+
+    // aligned for struct inotify_event
+    long buf[(64 * 1024) / sizeof(long)];
+    for (;;) {
+        ssize_t got = ::read(fd, buf, sizeof(buf));
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            std::fprintf(stderr, "Error: inotify: %s\n", std::strerror(errno));
+            return 1;
+        }
+        t0 = now_ns();
+        dirty.clear();
+        removed.clear();
+        for (const char* p = (const char*)buf; p < (const char*)buf + got;) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            std::map<int, std::string>::iterator d = dirs.find(ev->wd);
+            if (ev->mask & IN_IGNORED) {
+                if (d != dirs.end()) dirs.erase(d);
+                continue;
+            }
+            if (d == dirs.end() || ev->len == 0) continue;
+            std::string path = d->second + "/" + ev->name;
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                    watch_tree(fd, path, dirs, dirty);
+                continue;
+            }
+            if (!has_cp_ext(ev->name)) continue;
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                removed.insert(path);
+                dirty.erase(path);
+            }
+            else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                dirty.insert(path);
+                removed.erase(path);
+            }
+        }
+        if (dirty.empty() && removed.empty()) continue;
+        n = watch_refresh(w, dirty, removed);
+        std::fprintf(stderr, "watch: reconverted %d file(s) in %.3f ms\n", n,
+            (now_ns() - t0) / 1e6);
+    }
+#else
+    (void)root;
+    (void)dialect;
+    std::fprintf(stderr, "Error: --watch needs inotify (Linux)\n");
+    return 1;
+#endif
+}
+
+// ----- language server -----
+// --lsp speaks the Language Server Protocol (JSON-RPC over stdin/stdout).
+// Each open document is an IncrementalDoc, so a keystroke costs one
+// incremental edit, not a reconversion. Served:
+//   textDocument/didOpen, didChange (incremental sync), didClose
+//   textDocument/inlayHint   the '->' and ';' the conversion adds
+//   textDocument/publishDiagnostics   lexer errors, e.g. a forbidden '->'
+//   cplus/preview   {textDocument} -> {text}: the converted C++. Once a
+//                   document has been previewed, each edit also sends a
+//                   cplus/previewDidChange {uri, first, removed, lines}
+//                   hunk (0-based output lines).
+// Positions are in UTF-16 code units, the protocol's default.
+
+// Parsed JSON as a flat node array; children are linked by index.
+struct JsonNode {
+    enum Kind { Null, Bool, Number, String, Array, Object } kind;
+    std::string key;    // member name, for the children of an object
+    std::string str;    // String value
+    double num;         // Number value; Bool as 0 or 1
+    int first, next;    // first child, next sibling (-1: none)
+    size_t begin, end;  // source span, to echo request ids verbatim
+    JsonNode() : kind(Null), num(0), first(-1), next(-1), begin(0), end(0) {}
+};
+
+struct JsonDoc {
+    std::vector<JsonNode> nodes;  // [0] is the root
+
+    bool parse(const std::string& s) {
+        nodes.clear();
+        size_t i = 0;
+        if (value(s, i, 0) < 0) return false;
+        skip_ws(s, i);
+        return i == s.size();
+    }
+
+    // Member 'key' of object node 'n', or -1 (also when 'n' is -1).
+    int get(int n, const char* key) const {
+        if (n < 0 || nodes[n].kind != JsonNode::Object) return -1;
+        for (int c = nodes[n].first; c >= 0; c = nodes[c].next)
+            if (nodes[c].key == key) return c;
+        return -1;
+    }
+
+    const std::string& str(int n) const {
+        static const std::string none;
+        return n >= 0 && nodes[n].kind == JsonNode::String ? nodes[n].str
+                                                           : none;
+    }
+
+    int num(int n) const {
+        return n >= 0 && nodes[n].kind == JsonNode::Number ? (int)nodes[n].num
+                                                           : 0;
+    }
+
+private:
+    static void skip_ws(const std::string& s, size_t& i) {
+        while (i < s.size() &&
+            (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r'))
+            ++i;
+    }
+
+    static int hex4(const std::string& s, size_t i) {
+        if (i + 4 > s.size()) return -1;
+        int v = 0;
+        for (size_t k = i; k < i + 4; ++k) {
+            char c = s[k];
+            int d = c >= '0' && c <= '9' ? c - '0'
+                : c >= 'a' && c <= 'f'   ? c - 'a' + 10
+                : c >= 'A' && c <= 'F'   ? c - 'A' + 10
+                                         : -1;
+            if (d < 0) return -1;
+            v = v * 16 + d;
+        }
+        return v;
+    }
+
+    static void append_utf8(std::string& out, int cp) {
+        if (cp < 0x80)
+            out += (char)cp;
+        else if (cp < 0x800) {
+            out += (char)(0xC0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000) {
+            out += (char)(0xE0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+        else {
+            out += (char)(0xF0 | (cp >> 18));
+            out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    static bool parse_string(const std::string& s, size_t& i,
+        std::string& out) {
+        ++i;  // opening quote
+        while (i < s.size()) {
+            char c = s[i++];
+            if (c == '"') return true;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (i >= s.size()) return false;
+            char e = s[i++];
+            switch (e) {
+            case '"': case '\\': case '/': out += e; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                int cp = hex4(s, i);
+                if (cp < 0) return false;
+                i += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 &&
+                    s.compare(i, 2, "\\u") == 0) {
+                    int lo = hex4(s, i + 2);
+                    if (lo >= 0xDC00 && lo < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        i += 6;
+                    }
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default: return false;
+            }
+        }
+        return false;
+    }
+
+    // Parse one value at 'i' into a new node; its index, or -1.
+    int value(const std::string& s, size_t& i, int depth) {
+        skip_ws(s, i);
+        if (i >= s.size() || depth > 64) return -1;
+        int n = (int)nodes.size();
+        nodes.push_back(JsonNode());
+        nodes[n].begin = i;
+        char c = s[i];
+        if (c == '{' || c == '[') {
+            nodes[n].kind = c == '{' ? JsonNode::Object : JsonNode::Array;
+            const char close = c == '{' ? '}' : ']';
+            ++i;
+            skip_ws(s, i);
+            bool more = i >= s.size() || s[i] != close;
+            if (!more) ++i;
+            for (int last = -1; more;) {
+                std::string key;
+                if (c == '{') {
+                    skip_ws(s, i);
+                    if (i >= s.size() || s[i] != '"' ||
+                        !parse_string(s, i, key))
+                        return -1;
+                    skip_ws(s, i);
+                    if (i >= s.size() || s[i++] != ':') return -1;
+                }
+                int v = value(s, i, depth + 1);
+                if (v < 0) return -1;
+                nodes[v].key.swap(key);
+                if (last < 0)
+                    nodes[n].first = v;
+                else
+                    nodes[last].next = v;
+                last = v;
+                skip_ws(s, i);
+                if (i >= s.size()) return -1;
+                char sep = s[i++];
+                if (sep == close)
+                    more = false;
+                else if (sep != ',')
+                    return -1;
+            }
+        }
+        else if (c == '"') {
+            nodes[n].kind = JsonNode::String;
+            std::string v;
+            if (!parse_string(s, i, v)) return -1;
+            nodes[n].str.swap(v);
+        }
+        else if (s.compare(i, 4, "true") == 0 ||
+            s.compare(i, 5, "false") == 0) {
+            nodes[n].kind = JsonNode::Bool;
+            nodes[n].num = s[i] == 't';
+            i += s[i] == 't' ? 4 : 5;
+        }
+        else if (s.compare(i, 4, "null") == 0)
+            i += 4;
+        else {
+            const char* b = s.c_str() + i;
+            char* e = 0;
+            nodes[n].num = std::strtod(b, &e);
+            if (e == b) return -1;
+            nodes[n].kind = JsonNode::Number;
+            i += e - b;
+        }
+        nodes[n].end = i;
+        return n;
+    }
+};
+
+static void json_quote(std::string& out, const std::string& s) {
+    out += '"';
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        }
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '\t')
+            out += "\\t";
+        else if (c < 0x20) {
+            char buf[8];
+            std::sprintf(buf, "\\u%04x", c);
+            out += buf;
+        }
+        else
+            out += (char)c;
+    }
+    out += '"';
+}
+
+static void append_num(std::string& s, long v) {
+    char buf[24];
+    std::sprintf(buf, "%ld", v);
+    s += buf;
+}
+
+// UTF-16 code units in the UTF-8 text [b, e).
+static int utf16_length(const char* b, const char* e) {
+    int n = 0;
+    for (; b < e; ++b) {
+        unsigned char c = (unsigned char)*b;
+        if ((c & 0xC0) != 0x80) n += c >= 0xF0 ? 2 : 1;
+    }
+    return n;
+}
+
+// Byte offset of the 0-based LSP position (line, character).
+static size_t lsp_offset(const IncrementalDoc& d, int line, int character) {
+    const std::string& t = d.text;
+    size_t p = d.line_offset(line + 1);
+    size_t end = t.find('\n', p);
+    if (end == std::string::npos) end = t.size();
+    for (int units = 0; p < end && units < character;) {
+        unsigned char c = (unsigned char)t[p];
+        int len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        units += len == 4 ? 2 : 1;
+        p = std::min(end, p + len);
+    }
+    return p;
+}
+
+// {"line":..,"character":..} for 1-based 'line' and byte column 'col'.
+static void lsp_position(std::string& out, const IncrementalDoc& d, int line,
+    int col) {
+    const std::string& t = d.text;
+    size_t b = d.line_offset(line);
+    size_t e = t.find('\n', b);
+    if (e == std::string::npos) e = t.size();
+    size_t at = std::min(e, b + (size_t)(col > 1 ? col - 1 : 0));
+    out += "{\"line\":";
+    append_num(out, line - 1);
+    out += ",\"character\":";
+    append_num(out, utf16_length(t.data() + b, t.data() + at));
+    out += '}';
+}
+
+struct LspDoc {
+    IncrementalDoc inc;
+    bool previewed;
+    std::vector<LexError> published;  // last diagnostics sent
+    LspDoc() : previewed(false) {}
+};
+
+struct LspState {
+    std::map<std::string, LspDoc> docs;
+    std::set<std::string> builtins;
+    std::string in;  // stdin bytes not yet consumed
+    bool shutdown, done;
+    int edits, incremental;
+    double slowest_ms;
+    LspState()
+        : shutdown(false), done(false), edits(0), incremental(0),
+          slowest_ms(0) {}
+};
+
+// Next "Content-Length: N\r\n\r\n<body>" message; false at end of input.
+static bool lsp_read(LspState& s, std::string& body) {
+    for (;;) {
+        size_t hdr = s.in.find("\r\n\r\n");
+        if (hdr != std::string::npos) {
+            long len = -1;
+            for (size_t b = 0; b < hdr;) {
+                size_t e = s.in.find("\r\n", b);
+                std::string field = s.in.substr(b, e - b);
+                for (size_t k = 0; k < field.size() && field[k] != ':'; ++k)
+                    field[k] = (char)std::tolower((unsigned char)field[k]);
+                if (field.compare(0, 15, "content-length:") == 0)
+                    len = std::atol(field.c_str() + 15);
+                b = e + 2;
+            }
+            if (len < 0) {  // not a message we can frame; drop the header
+                s.in.erase(0, hdr + 4);
+                continue;
+            }
+            if (s.in.size() >= hdr + 4 + (size_t)len) {
+                body.assign(s.in, hdr + 4, (size_t)len);
+                s.in.erase(0, hdr + 4 + (size_t)len);
+                return true;
+            }
+        }
+        char chunk[65536];
+#ifdef CPLUS_POSIX
+        ssize_t n = ::read(0, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+#else
+        long n = (long)std::fread(chunk, 1, sizeof(chunk), stdin);
+#endif
+        if (n <= 0) return false;
+        s.in.append(chunk, (size_t)n);
+    }
+}
+
+static void lsp_send(const std::string& body) {
+    char head[48];
+    std::sprintf(head, "Content-Length: %lu\r\n\r\n",
+        (unsigned long)body.size());
+    std::string msg = head;
+    msg += body;
+#ifdef CPLUS_POSIX
+    size_t done = 0;
+    while (done < msg.size()) {
+        ssize_t n = ::write(1, msg.data() + done, msg.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        done += (size_t)n;
+    }
+#else
+    std::fwrite(msg.data(), 1, msg.size(), stdout);
+    std::fflush(stdout);
+#endif
+}
+
+static void lsp_reply(const std::string& id, const std::string& result) {
+    lsp_send("{\"jsonrpc\":\"2.0\",\"id\":" + id + ",\"result\":" + result +
+        "}");
+}
+
+static void lsp_error(const std::string& id, int code, const char* message) {
+    std::string body = "{\"jsonrpc\":\"2.0\",\"id\":" + id +
+        ",\"error\":{\"code\":";
+    append_num(body, code);
+    body += ",\"message\":";
+    json_quote(body, message);
+    body += "}}";
+    lsp_send(body);
+}
+
+static void lsp_notify(const char* method, const std::string& params) {
+    lsp_send(std::string("{\"jsonrpc\":\"2.0\",\"method\":\"") + method +
+        "\",\"params\":" + params + "}");
+}
+
+static void lsp_publish(const std::string& uri, LspDoc& d) {
+    const std::vector<LexError>& errs = d.inc.errors();
+    bool same = errs.size() == d.published.size();
+    for (size_t k = 0; same && k < errs.size(); ++k)
+        same = errs[k].line == d.published[k].line &&
+            errs[k].col == d.published[k].col;
+    if (same) return;
+    d.published = errs;
+    std::string p = "{\"uri\":";
+    json_quote(p, uri);
+    p += ",\"diagnostics\":[";
+    for (size_t k = 0; k < errs.size(); ++k) {
+        if (k) p += ',';
+        p += "{\"range\":{\"start\":";
+        lsp_position(p, d.inc, errs[k].line, errs[k].col);
+        p += ",\"end\":";
+        lsp_position(p, d.inc, errs[k].line, errs[k].col + 2);
+        p += "},\"severity\":1,\"source\":\"cplus\",\"message\":";
+        json_quote(p, errs[k].message);
+        p += '}';
+    }
+    p += "]}";
+    lsp_notify("textDocument/publishDiagnostics", p);
+}
+
+static void lsp_preview_hunk(const std::string& uri, const LineDiff& diff) {
+    if (diff.removed == 0 && diff.lines.empty()) return;
+    std::string p = "{\"uri\":";
+    json_quote(p, uri);
+    p += ",\"first\":";
+    append_num(p, diff.first);
+    p += ",\"removed\":";
+    append_num(p, diff.removed);
+    p += ",\"lines\":[";
+    for (size_t k = 0; k < diff.lines.size(); ++k) {
+        if (k) p += ',';
+        json_quote(p, diff.lines[k]);
+    }
+    p += "]}";
+    lsp_notify("cplus/previewDidChange", p);
+}
+
+static void lsp_did_change(LspState& s, const JsonDoc& j, int params) {
+    const std::string& uri =
+        j.str(j.get(j.get(params, "textDocument"), "uri"));
+    std::map<std::string, LspDoc>::iterator it = s.docs.find(uri);
+    int changes = j.get(params, "contentChanges");
+    if (it == s.docs.end() || changes < 0) return;
+    LspDoc& d = it->second;
+    for (int c = j.nodes[changes].first; c >= 0; c = j.nodes[c].next) {
+        int text = j.get(c, "text"), range = j.get(c, "range");
+        if (text < 0) continue;
+        LineDiff diff;
+        double t0 = now_ns();
+        if (range < 0) {  // whole-document replacement
+            std::string old = d.inc.output();
+            d.inc.open(j.str(text), s.builtins);
+            make_line_diff(0, old, d.inc.output(), diff);
+        }
+        else {
+            int a = j.get(range, "start"), b = j.get(range, "end");
+            size_t from = lsp_offset(d.inc, j.num(j.get(a, "line")),
+                j.num(j.get(a, "character")));
+            size_t to = lsp_offset(d.inc, j.num(j.get(b, "line")),
+                j.num(j.get(b, "character")));
+            if (to < from) std::swap(from, to);
+            s.incremental += d.inc.edit(from, to - from, j.str(text), diff);
+        }
+        double ms = (now_ns() - t0) / 1e6;
+        if (ms > s.slowest_ms) s.slowest_ms = ms;
+        ++s.edits;
+        if (d.previewed) lsp_preview_hunk(uri, diff);
+    }
+    lsp_publish(uri, d);
+}
+
+static std::string lsp_inlay_hints(const LspState& s, const JsonDoc& j,
+    int params) {
+    const std::string& uri =
+        j.str(j.get(j.get(params, "textDocument"), "uri"));
+    std::map<std::string, LspDoc>::const_iterator it = s.docs.find(uri);
+    if (it == s.docs.end()) return "[]";
+    const IncrementalDoc& d = it->second.inc;
+    int range = j.get(params, "range");
+    int first = j.num(j.get(j.get(range, "start"), "line")) + 1;
+    int last = range < 0 ? d.line_count()
+                         : j.num(j.get(j.get(range, "end"), "line")) + 1;
+    if (first < 1) first = 1;
+    if (last > d.line_count()) last = d.line_count();
+    std::string out = "[";
+    for (int l = first; l <= last; ++l) {
+        const std::vector<Hint>& hs = d.hints(l);
+        for (size_t k = 0; k < hs.size(); ++k) {
+            if (out.size() > 1) out += ',';
+            out += "{\"position\":";
+            lsp_position(out, d, l, hs[k].col);
+            out += ",\"label\":";
+            json_quote(out, hs[k].label);
+            out += '}';
+        }
+    }
+    out += ']';
+    return out;
+}
+
+static void lsp_handle(LspState& s, const std::string& body) {
+    JsonDoc j;
+    if (!j.parse(body)) {
+        lsp_error("null", -32700, "parse error");
+        return;
+    }
+    int id_node = j.get(0, "id"), params = j.get(0, "params");
+    const std::string& m = j.str(j.get(0, "method"));
+    if (m.empty()) return;  // a response, or not a request at all
+    std::string id = id_node < 0 ? std::string()
+                                 : body.substr(j.nodes[id_node].begin,
+                                       j.nodes[id_node].end -
+                                           j.nodes[id_node].begin);
+    if (m == "exit") {
+        s.done = true;
+        return;
+    }
+    if (s.shutdown) {
+        if (!id.empty()) lsp_error(id, -32600, "server is shut down");
+        return;
+    }
+    if (m == "initialize")
+        lsp_reply(id,
+            "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,"
+            "\"change\":2},\"inlayHintProvider\":true},"
+            "\"serverInfo\":{\"name\":\"cplus2cpp\"}}");
+    else if (m == "shutdown") {
+        s.shutdown = true;
+        lsp_reply(id, "null");
+    }
+    else if (m == "textDocument/didOpen") {
+        int td = j.get(params, "textDocument");
+        const std::string& uri = j.str(j.get(td, "uri"));
+        LspDoc& d = s.docs[uri];
+        d.inc.open(j.str(j.get(td, "text")), s.builtins);
+        d.published.clear();
+        d.published.resize(1);  // differs from any list: always publish
+        lsp_publish(uri, d);
+    }
+    else if (m == "textDocument/didChange")
+        lsp_did_change(s, j, params);
+    else if (m == "textDocument/didClose") {
+        const std::string& uri =
+            j.str(j.get(j.get(params, "textDocument"), "uri"));
+        if (s.docs.erase(uri)) {
+            std::string p = "{\"uri\":";
+            json_quote(p, uri);
+            p += ",\"diagnostics\":[]}";
+            lsp_notify("textDocument/publishDiagnostics", p);
+        }
+    }
+    else if (m == "textDocument/inlayHint")
+        lsp_reply(id, lsp_inlay_hints(s, j, params));
+    else if (m == "cplus/preview") {
+        const std::string& uri =
+            j.str(j.get(j.get(params, "textDocument"), "uri"));
+        std::map<std::string, LspDoc>::iterator it = s.docs.find(uri);
+        if (it == s.docs.end()) {
+            lsp_error(id, -32602, "document is not open");
+            return;
+        }
+        it->second.previewed = true;
+        std::string r = "{\"text\":";
+        json_quote(r, it->second.inc.output());
+        r += '}';
+        lsp_reply(id, r);
+    }
+    else if (!id.empty())
+        lsp_error(id, -32601, "method not found");
+}
+
+static int lsp_serve() {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    LspState s;
+    s.builtins = builtin_types();
+    std::string body;
+    while (!s.done && lsp_read(s, body)) lsp_handle(s, body);
+    std::fprintf(stderr,
+        "lsp: %d edit(s), %d incremental; slowest %.3f ms\n", s.edits,
+        s.incremental, s.slowest_ms);
+    return s.shutdown ? 0 : 1;
+}
+
+// ----- shared precompiled header -----
+// --pch=FILE writes a header of the includes that at least --pch-min
+// percent (default 50) of the batch's inputs share, in order of first
+// occurrence, for the compiler to precompile once for the whole batch.
+// Only a file's leading includes count (the #include lines before its
+// first other directive or code), and of those only <...> ones: a quoted
+// include resolves against the including file's directory, so the same
+// spelling can name different headers. --pch-strip also drops the shared
+// includes from an output, which is then compiled with '-include FILE'
+// (g++ picks up FILE.gch by itself), but only when its leading includes
+// start with exactly the shared ones in header order; anything the file
+// includes before them could change what they mean.
+
+// "<x.h>" or "\"x.h\"" of an #include directive spanning [b, e), or false.
+static bool include_target(const char* b, const char* e, std::string& hdr) {
+    if (b == e || *b != '#') return false;
+    for (++b; b < e && (*b == ' ' || *b == '\t');) ++b;
+    if (e - b < 7 || std::memcmp(b, "include", 7) != 0) return false;
+    for (b += 7; b < e && (*b == ' ' || *b == '\t');) ++b;
+    if (b == e || (*b != '<' && *b != '"')) return false;
+    const char* close =
+        (const char*)std::memchr(b + 1, *b == '<' ? '>' : '"', e - b - 1);
+    if (!close) return false;
+    hdr.assign(b, close + 1);
+    return true;
+}
+
+// The leading includes of a source text, in order, without duplicates.
+static void leading_includes(const std::string& src,
+    std::vector<std::string>& out) {
+    out.clear();
+    const char* p = src.data();
+    const char* e = p + src.size();
+    while (p < e) {
+        if (std::isspace((unsigned char)*p)) {
+            ++p;
+            continue;
+        }
+        if (e - p >= 2 && p[0] == '/' && p[1] == '/') {
+            p = (const char*)std::memchr(p, '\n', e - p);
+            if (!p) break;
+            continue;
+        }
+        if (e - p >= 2 && p[0] == '/' && p[1] == '*') {
+            const char* q = p + 2;
+            while (q + 1 < e && !(q[0] == '*' && q[1] == '/')) ++q;
+            p = q + 2;
+            continue;
+        }
+        const char* eol = (const char*)std::memchr(p, '\n', e - p);
+        if (!eol) eol = e;
+        std::string hdr;
+        if (!include_target(p, eol, hdr)) break;
+        if (std::find(out.begin(), out.end(), hdr) == out.end())
+            out.push_back(hdr);
+        p = eol;
+    }
+}
+
+// Pick the shared includes of 'inputs' (in first-occurrence order) and
+// the text of the guarded header 'path' that includes them.
+static void plan_pch(const std::vector<const char*>& inputs, int min_percent,
+    const char* path, std::vector<std::string>& shared, std::string& text) {
+    std::vector<std::string> order, incs;
+    std::map<std::string, int> files_with;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::string src;
+        if (!read_file(inputs[i], src)) continue;  // reported when converted
+        leading_includes(src, incs);
+        for (size_t k = 0; k < incs.size(); ++k)
+            if (incs[k][0] == '<' && files_with[incs[k]]++ == 0)
+                order.push_back(incs[k]);
+    }
+    shared.clear();
+    for (size_t k = 0; k < order.size(); ++k)
+        if (files_with[order[k]] * 100 >= min_percent * (int)inputs.size())
+            shared.push_back(order[k]);
+
+    std::string guard = "CPLUS_PCH_";
+    for (const char* c = path; *c; ++c)
+        guard += isIdentChar(*c) ? (char)std::toupper((unsigned char)*c) : '_';
+    char head[160];
+    std::sprintf(head,
+        "// Generated by cplus2cpp: includes shared by at least %d%% of %d "
+        "file(s).\n",
+        min_percent, (int)inputs.size());
+    text = head;
+    text += "#ifndef " + guard + "\n#define " + guard + "\n";
+    for (size_t k = 0; k < shared.size(); ++k)
+        text += "#include " + shared[k] + "\n";
+    text += "#endif\n";
+}
+
+// Drop the shared includes from an output whose first lines are exactly
+// those includes in header order (directives are emitted verbatim, one per
+// line), and their line map entries. Any other output is left alone.
+static void strip_shared_includes(std::string& out,
+    const std::vector<std::string>& shared, LineMap* map) {
+    size_t p = 0;
+    for (size_t k = 0; k < shared.size(); ++k) {
+        size_t eol = out.find('\n', p);
+        eol = eol == std::string::npos ? out.size() : eol + 1;
+        std::string hdr;
+        if (!include_target(out.data() + p, out.data() + eol, hdr) ||
+            hdr != shared[k])
+            return;
+        p = eol;
+    }
+    out.erase(0, p);
+    if (map) {
+        size_t n = std::min(shared.size(), map->line.size());
+        map->pos.erase(map->pos.begin(), map->pos.begin() + n);
+        map->line.erase(map->line.begin(), map->line.begin() + n);
+        map->col.erase(map->col.begin(), map->col.begin() + n);
+    }
+}
+
+// ----- batch conversion -----
+enum FileResult { FileOk, FileFailed, FileStale };
+
+// What convert_file does with each converted text.
+struct OutputOptions {
+    bool check;     // compare with the existing .cpp; write nothing
+    bool line_map;  // also write <out>.cpp.map
+    const std::vector<std::string>* strip_includes;  // --pch-strip
+    PackWriter* packer;  // write into this archive instead of files
+    const char* pack;    // its path, for messages
+    OutputOptions()
+        : check(false), line_map(false), strip_includes(0), packer(0),
+        pack(0) {}
+};
+
+// Read, convert and write (or --check, or add to the pack) one input.
+static FileResult convert_file(const char* inpath,
+    const DialectEntry* dialect, std::set<std::string>& known_types,
+    const OutputOptions& opt, FileProfile* prof) {
+    const bool check = opt.check;
+    PackWriter* packer = opt.packer;
+    if (prof) {
+        prof->path = inpath;
+        prof->open_file();
+    }
+
+    CPLUS_PROBE1(file__start, inpath);
+    CPLUS_TRACE_CLOCK(t_file);
+    std::string src;
+    CPLUS_PROBE1(phase__start, "read");
+    if (prof) prof->begin(FileProfile::Read);
+    bool read_ok = read_file(inpath, src);
+    if (prof) prof->end();
+    CPLUS_PROBE3(phase__end, "read", src.size(), CPLUS_TRACE_NS(t_file));
+    if (prof) prof->src_bytes = src.size();
+    if (!read_ok) {
+        std::fprintf(stderr, "Error: cannot read: %s\n", inpath);
+        if (prof) prof->close_file();
+        // every file__start gets its file__end, with nothing converted
+        CPLUS_PROBE4(file__end, inpath, 0, 0, CPLUS_TRACE_NS(t_file));
+        return FileFailed;
+    }
+
+    std::string outcpp;
+    LineMap map;
+    bool want_map = opt.line_map;
+    dialect->convert(src, known_types, outcpp, prof, want_map ? &map : 0);
+    if (opt.strip_includes)
+        strip_shared_includes(outcpp, *opt.strip_includes,
+            want_map ? &map : 0);
+
+    std::string outpath = replace_ext(inpath, ".cpp");
+    // in a pack: the name relative to the working directory (main() has
+    // refused inputs outside it)
+    if (packer) pack_name(replace_ext(inpath, ".cpp"), outpath);
+    CPLUS_PROBE1(phase__start, "write");
+    CPLUS_TRACE_CLOCK(t_write);
+    if (prof) prof->begin(FileProfile::Write);
+    // --check: the "write" phase compares against the existing output
+    long stale = 0, map_stale = 0;
+    bool write_ok = true;
+    if (check)
+        stale = compare_text_file(outpath, outcpp);
+    else if (packer)
+        write_ok = packer->add(outpath, outcpp);
+    else
+        write_ok = write_text_file(outpath, outcpp);
+    if (want_map && write_ok) {
+        std::string enc;
+        encode_line_map(map, enc);
+        if (check)
+            map_stale = compare_text_file(outpath + ".map", enc);
+        else
+            write_ok = packer ? packer->add(outpath + ".map", enc)
+                              : write_text_file(outpath + ".map", enc);
+    }
+    if (prof) {
+        prof->end();
+        prof->close_file();
+    }
+    CPLUS_PROBE3(phase__end, "write", outcpp.size(), CPLUS_TRACE_NS(t_write));
+    CPLUS_PROBE4(file__end, inpath, src.size(), outcpp.size(),
+        CPLUS_TRACE_NS(t_file));
+    if (check) {
+        if (stale == -1)
+            std::fprintf(stderr, "Stale %s (missing)\n", outpath.c_str());
+        else if (stale == -2)
+            std::fprintf(stderr, "Stale %s (size differs)\n",
+                outpath.c_str());
+        else if (stale > 0)
+            std::fprintf(stderr, "Stale %s (differs at line %ld)\n",
+                outpath.c_str(), stale);
+        // the sidecar is binary, so a line number would mean nothing
+        if (map_stale == -1)
+            std::fprintf(stderr, "Stale %s.map (missing)\n", outpath.c_str());
+        else if (map_stale)
+            std::fprintf(stderr, "Stale %s.map (differs)\n", outpath.c_str());
+        return stale || map_stale ? FileStale : FileOk;
+    }
+    if (!write_ok) {
+        std::fprintf(stderr, "Error: cannot write: %s\n",
+            packer ? opt.pack : outpath.c_str());
+        return FileFailed;
+    }
+    if (!packer) std::fprintf(stderr, "Wrote %s\n", outpath.c_str());
+    return FileOk;
+}
+
+// --jobs=N converts up to N files at once, each in a forked worker, so a
+// worker's whole heap goes back to the system when it exits. --max-mem caps
+// the sum of the workers' estimated working sets: a file is admitted only
+// while its estimate fits next to the running ones, and files that do not
+// fit yet are passed over for later (smaller) ones until memory frees up. A
+// file over the whole budget runs alone.
+//
+// A file's known_types depend on the files before it, so a prepass lexes
+// the inputs one at a time, in batch order, and records the type names each
+// declares; a worker starts from the builtins plus its predecessors' names,
+// exactly what the sequential loop would have given it.
+
+// Working set of a conversion, from its input size: --mem-stats puts the
+// live high-water mark at ~70x the input (tokens, lines and output), plus
+// the process itself.
+static const unsigned long long kWorkingSetPerByte = 72;
+static const unsigned long long kWorkingSetBase = 4ull << 20;
+
+// Worker exit code for a stale output (the lexer exits with 2).
+static const int kStaleExit = 3;
+
+static unsigned long long estimate_working_set(unsigned long long bytes) {
+    return kWorkingSetBase + bytes * kWorkingSetPerByte;
+}
+
+// "512M", "2G", "65536K" or plain bytes; 0 if malformed.
+static unsigned long long parse_size(const char* s) {
+    char* end = 0;
+    double v = std::strtod(s, &end);
+    if (end == s || v < 0) return 0;
+    switch (*end) {
+    case 'k': case 'K': v *= 1024.0; ++end; break;
+    case 'm': case 'M': v *= 1024.0 * 1024.0; ++end; break;
+    case 'g': case 'G': v *= 1024.0 * 1024.0 * 1024.0; ++end; break;
+    }
+    if (*end == 'i' || *end == 'B') ++end;
+    if (*end == 'B') ++end;
+    return *end ? 0 : (unsigned long long)v;
+}
+
+// A whole decimal count of at least 1; 0 if malformed or below 1.
+static int parse_count(const char* s) {
+    char* end = 0;
+    long v = std::strtol(s, &end, 10);
+    return end == s || *end || v < 1 || v != (int)v ? 0 : (int)v;
+}
+
+// The type names a source adds to known_types (by declared_type_name, with
+// initializer bodies skipped as analyze_range skips them). Lex errors are
+// left for the worker to report.
+static void collect_type_names(const std::string& src,
+    std::vector<std::string>& names) {
+    std::vector<Token> tk;
+    std::vector<LineSummary> summaries;
+    std::vector<LexError> errors;
+    lex(preprocess_physical_lines(src), tk, summaries, false, 0, 0, &errors);
+    for (size_t i = 0; i < tk.size(); ++i) {
+        if (is_op(tk, (int)i, "=") && is_p(tk, (int)i + 1, "{")) {
+            size_t close = find_matching_brace(tk, i + 1);
+            if (close != tk.size()) {
+                i = close;
+                continue;
+            }
+        }
+        int declared = declared_type_name(tk, i);
+        if (declared != -1) names.push_back(tk[declared].text);
+    }
+}
+
+static int convert_batch(const std::vector<const char*>& inputs,
+    const DialectEntry* dialect, const OutputOptions& opt, int jobs,
+    unsigned long long max_mem, int& stale_files) {
+#ifdef CPLUS_POSIX
+    const size_t n = inputs.size();
+    std::vector<unsigned long long> estimate(n);
+    std::vector<size_t> names_end(n);  // file i: names[end(i-1), end(i))
+    std::vector<std::string> names;
+    for (size_t i = 0; i < n; ++i) {
+        std::string src;
+        if (read_file(inputs[i], src)) collect_type_names(src, names);
+        estimate[i] = estimate_working_set(src.size());
+        names_end[i] = names.size();
+    }
+
+    int exit_code = 0;
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < n; ++i) pending.push_back(i);
+    std::map<pid_t, size_t> running;
+    unsigned long long in_use = 0, peak_in_use = 0;
+    std::vector<bool> passed_over(n, false);
+    int deferred = 0;
+    long worst_rss_kib = 0;
+    size_t worst = n;
+    while (!pending.empty() || !running.empty()) {
+        for (size_t k = 0; k < pending.size() && (int)running.size() < jobs;) {
+            size_t i = pending[k];
+            if (max_mem && in_use + estimate[i] > max_mem && !running.empty()) {
+                if (!passed_over[i]) {
+                    passed_over[i] = true;
+                    ++deferred;
+                }
+                ++k;
+                continue;
+            }
+            if (max_mem && estimate[i] > max_mem)
+                std::fprintf(stderr,
+                    "batch: %s needs ~%llu MiB, over --max-mem; running it "
+                    "alone\n",
+                    inputs[i], estimate[i] >> 20);
+            pid_t pid = ::fork();
+            if (pid == 0) {
+                std::set<std::string> known_types = builtin_types();
+                known_types.insert(names.begin(),
+                    names.begin() + (i ? names_end[i - 1] : 0));
+                FileResult r =
+                    convert_file(inputs[i], dialect, known_types, opt, 0);
+                ::_exit(r == FileStale ? kStaleExit : r == FileOk ? 0 : 1);
+            }
+            if (pid < 0) {
+                if (running.empty()) {
+                    std::fprintf(stderr, "Error: fork: %s\n",
+                        std::strerror(errno));
+                    return 1;
+                }
+                break;  // retry once a worker exits
+            }
+            running[pid] = i;
+            in_use += estimate[i];
+            peak_in_use = std::max(peak_in_use, in_use);
+            pending.erase(pending.begin() + k);
+        }
+
+        int status = 0;
+        struct rusage ru;
+        pid_t pid = ::wait4(-1, &status, 0, &ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            std::fprintf(stderr, "Error: wait: %s\n", std::strerror(errno));
+            return 1;
+        }
+        std::map<pid_t, size_t>::iterator it = running.find(pid);
+        if (it == running.end()) continue;
+        size_t i = it->second;
+        running.erase(it);
+        in_use -= estimate[i];
+#ifdef __APPLE__
+        long rss_kib = (long)(ru.ru_maxrss / 1024);  // bytes on macOS
+#else
+        long rss_kib = (long)ru.ru_maxrss;
+#endif
+        if (rss_kib > worst_rss_kib) {
+            worst_rss_kib = rss_kib;
+            worst = i;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == kStaleExit)
+            ++stale_files;
+        else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if (WIFSIGNALED(status))
+                std::fprintf(stderr, "Error: %s: worker killed by signal %d\n",
+                    inputs[i], WTERMSIG(status));
+        }
+        else
+            continue;
+        exit_code = 1;
+    }
+
+    std::fprintf(stderr,
+        "batch: %d file(s), %d job(s), estimated peak %llu MiB", (int)n, jobs,
+        peak_in_use >> 20);
+    if (max_mem)
+        std::fprintf(stderr, " of %llu MiB, %d deferral(s)", max_mem >> 20,
+            deferred);
+    std::fprintf(stderr, "\n");
+    if (worst < n)
+        std::fprintf(stderr,
+            "batch: largest worker RSS %ld KiB (%s, estimated %llu KiB)\n",
+            worst_rss_kib, inputs[worst], estimate[worst] >> 10);
+    return exit_code;
+#else
+    (void)inputs;
+    (void)dialect;
+    (void)opt;
+    (void)jobs;
+    (void)max_mem;
+    (void)stale_files;
+    std::fprintf(stderr, "Error: --jobs needs a POSIX system\n");
+    return 1;
+#endif
+}
+
+static void print_usage(const char* argv0) {
+    std::fprintf(stderr,
+        "Usage: %s [--dialect=full|members|semicolons] <file1.cp> "
+        "[file2.cp ...]\n"
+        "       %s --bench-startup[=RUNS] [--startup-budget=USEC]\n"
+        "       %s [--dialect=NAME] --stream < in.cp > out.cpp\n"
+        "       %s --remap < compiler-output\n"
+        "       %s [--dialect=NAME] --to-cplus=DIR file.c ...\n"
+        "       %s [--dialect=NAME] --watch DIR\n"
+        "       %s --unpack=PACK [--unpack-dir=DIR] [name.cpp ...]\n"
+        "       %s --lsp\n"
+        "Options:\n"
+        "  --profile-report[=N]  time each file and report the N slowest files\n"
+        "                        and line ranges (default 10)\n"
+        "  --mem-stats           report bytes allocated and live per phase\n"
+        "                        and peak RSS for each file (needs a\n"
+        "                        -DCPLUS_ALLOC_HOOKS build)\n"
+        "  --pack=FILE           write all outputs into one archive FILE\n"
+        "  --line-map            also write <out>.cpp.map, the source line\n"
+        "                        and column of every output line\n"
+        "  --pch=FILE            write the includes most inputs share to\n"
+        "                        FILE, a header to precompile\n"
+        "  --pch-min=PERCENT     share needed to be in FILE (default 50)\n"
+        "  --pch-strip           drop those includes from the outputs\n"
+        "                        (compile them with -include FILE)\n"
+        "  -DNAME[=VALUE]        NAME is defined for #if/#ifdef; branches\n"
+        "  -UNAME                that are certainly not taken are copied\n"
+        "                        verbatim, not converted\n"
+        "  --check, --dry-run    write nothing; exit 1 if any .cpp is\n"
+        "                        missing or differs from the conversion\n"
+        "  --jobs=N              convert up to N files at once\n"
+        "  --max-mem=SIZE        admit files only while their estimated\n"
+        "                        working sets fit SIZE (e.g. 2G, 512M)\n",
+        argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+// Built with CPLUS_NO_MAIN the file can be #included as a library (see
+// convert_tokens); the command line then stays reachable as cplus_main().
+#ifdef CPLUS_NO_MAIN
+int cplus_main(int argc, char** argv) {
+#else
+int main(int argc, char** argv) {
+#endif
+#ifdef CPLUS_ALLOC_HOOKS
+    // --mem-stats follows live bytes from the start, so what argument
+    // parsing and setup allocate (and a file may free) is accounted for
+    for (int ai = 1; ai < argc; ++ai)
+        if (std::strcmp(argv[ai], "--mem-stats") == 0) {
+            g_alloc_counting = true;
+            g_live_tracking = true;
+        }
+#endif
+    const DialectEntry* dialect = &kDialects[0];
+    std::vector<const char*> inputs;
+    int startup_runs = 0;
+    double startup_budget_us = 0;
+    int profile_top = 0;
+    bool stream = false;
+    bool line_map = false;
+    bool remap = false;
+    const char* to_cplus_dir = 0;
+    const char* pch = 0;
+    int pch_min = 50;
+    bool pch_strip = false;
+    bool mem_stats = false;
+    bool lsp = false;
+    bool check = false;
+    const char* pack = 0;
+    const char* unpack_from = 0;
+    const char* unpack_dir = ".";
+    const char* watch = 0;
+    int jobs = 0;
+    unsigned long long max_mem = 0;
+    for (int ai = 1; ai < argc; ++ai) {
+        const char* arg = argv[ai];
+        const char* name = 0;
+        if (std::strcmp(arg, "--bench-startup") == 0) {
+            startup_runs = 50;
+            continue;
+        }
+        if (std::strncmp(arg, "--bench-startup=", 16) == 0) {
+            startup_runs = parse_count(arg + 16);
+            if (!startup_runs) {
+                std::fprintf(stderr, "Error: --bench-startup needs at least "
+                    "one run: %s\n", arg + 16);
+                return 1;
+            }
+            continue;
+        }
+        if (std::strncmp(arg, "--watch=", 8) == 0) {
+            watch = arg + 8;
+            continue;
+        }
+        if (std::strcmp(arg, "--watch") == 0 && ai + 1 < argc) {
+            watch = argv[++ai];
+            continue;
+        }
+        if (std::strcmp(arg, "--check") == 0 ||
+            std::strcmp(arg, "--dry-run") == 0) {
+            check = true;
+            continue;
+        }
+        if (std::strncmp(arg, "--pack=", 7) == 0) {
+            pack = arg + 7;
+            continue;
+        }
+        if (std::strncmp(arg, "--unpack=", 9) == 0) {
+            unpack_from = arg + 9;
+            continue;
+        }
+        if (std::strncmp(arg, "--unpack-dir=", 13) == 0) {
+            unpack_dir = arg + 13;
+            continue;
+        }
+        if (std::strncmp(arg, "--jobs=", 7) == 0) {
+            jobs = parse_count(arg + 7);
+            if (!jobs) {
+                std::fprintf(stderr, "Error: bad --jobs count: %s\n",
+                    arg + 7);
+                return 1;
+            }
+            continue;
+        }
+        if (std::strncmp(arg, "--max-mem=", 10) == 0) {
+            max_mem = parse_size(arg + 10);
+            if (!max_mem) {
+                std::fprintf(stderr, "Error: bad --max-mem size: %s\n",
+                    arg + 10);
+                return 1;
+            }
+            continue;
+        }
+        if (std::strcmp(arg, "--lsp") == 0) {
+            lsp = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--mem-stats") == 0) {
+            mem_stats = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--stream") == 0) {
+            stream = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--line-map") == 0) {
+            line_map = true;
+            continue;
+        }
+        if (std::strncmp(arg, "--to-cplus=", 11) == 0) {
+            to_cplus_dir = arg + 11;
+            continue;
+        }
+        if (std::strcmp(arg, "--remap") == 0) {
+            remap = true;
+            continue;
+        }
+        if (arg[0] == '-' && arg[1] == 'D' && arg[2]) {
+            const char* eq = std::strchr(arg + 2, '=');
+            std::string macro = eq ? std::string(arg + 2, eq) : arg + 2;
+            g_macros.defined[macro] = eq ? eq + 1 : "";
+            g_macros.undefined.erase(macro);
+            continue;
+        }
+        if (arg[0] == '-' && arg[1] == 'U' && arg[2]) {
+            g_macros.undefined.insert(arg + 2);
+            g_macros.defined.erase(arg + 2);
+            continue;
+        }
+        if (std::strncmp(arg, "--pch=", 6) == 0) {
+            pch = arg + 6;
+            continue;
+        }
+        if (std::strncmp(arg, "--pch-min=", 10) == 0) {
+            pch_min = parse_count(arg + 10);
+            if (!pch_min || pch_min > 100) {
+                std::fprintf(stderr, "Error: --pch-min needs a percentage "
+                    "from 1 to 100: %s\n", arg + 10);
+                return 1;
+            }
+            continue;
+        }
+        if (std::strcmp(arg, "--pch-strip") == 0) {
+            pch_strip = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--profile-report") == 0) {
+            profile_top = 10;
+            continue;
+        }
+        if (std::strncmp(arg, "--profile-report=", 17) == 0) {
+            profile_top = parse_count(arg + 17);
+            if (!profile_top) {
+                std::fprintf(stderr, "Error: bad --profile-report count: "
+                    "%s\n", arg + 17);
+                return 1;
+            }
+            continue;
+        }
+        if (std::strncmp(arg, "--startup-budget=", 17) == 0) {
+            startup_budget_us = std::atof(arg + 17);
+            continue;
+        }
+        if (std::strncmp(arg, "--dialect=", 10) == 0)
+            name = arg + 10;
+        else if (std::strcmp(arg, "--dialect") == 0 && ai + 1 < argc)
+            name = argv[++ai];
+        else if (arg[0] == '-' && arg[1] == '-') {
+            std::fprintf(stderr, "Error: unknown option: %s\n", arg);
+            print_usage(argv[0]);
+            return 1;
+        }
+        else {
+            inputs.push_back(arg);
+            continue;
+        }
+        dialect = find_dialect(name);
+        if (!dialect) {
+            std::fprintf(stderr, "Error: unknown dialect: %s\n", name);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (startup_runs > 0)
+        return bench_startup(argv[0], startup_runs, startup_budget_us);
+    if (stream) return stream_stdio(dialect);
+    if (remap) return remap_stdio();
+    if (to_cplus_dir) {
+        if (inputs.empty()) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        return to_cplus_files(to_cplus_dir, inputs, dialect);
+    }
+    if (watch) return watch_dir(watch, dialect);
+    if (lsp) return lsp_serve();
+    if (unpack_from) return unpack(unpack_from, inputs, unpack_dir);
+    if (inputs.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (mem_stats) {
+#ifndef CPLUS_ALLOC_HOOKS
+        std::fprintf(stderr,
+            "Error: --mem-stats needs a build with -DCPLUS_ALLOC_HOOKS\n");
+        return 1;
+#endif
+        g_alloc_counting = true;
+        g_live_tracking = true;
+    }
+    std::set<std::string> known_types = builtin_types();
+
+    std::vector<FileProfile> profiles;
+    if (profile_top || mem_stats) profiles.reserve(inputs.size());
+
+    if (check && pack) {
+        std::fprintf(stderr, "Error: --check and --pack do not combine\n");
+        return 1;
+    }
+    // --max-mem alone runs one worker per CPU
+    if (max_mem && !jobs) {
+#ifdef CPLUS_POSIX
+        jobs = (int)::sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (jobs < 1) jobs = 1;
+    }
+    if (jobs > 1 && (pack || profile_top || mem_stats)) {
+        std::fprintf(stderr,
+            "Error: --jobs does not combine with --pack, --profile-report or "
+            "--mem-stats\n");
+        return 1;
+    }
+    for (size_t i = 0; pack && i < inputs.size(); ++i) {
+        std::string name;
+        if (!pack_name(replace_ext(inputs[i], ".cpp"), name)) {
+            std::fprintf(stderr,
+                "Error: %s is outside the working directory; run --pack "
+                "from a directory that contains every input\n",
+                inputs[i]);
+            return 1;
+        }
+    }
+    PackWriter packer;
+    if (pack && !packer.open(pack)) {
+        std::fprintf(stderr, "Error: cannot write: %s\n", pack);
+        return 1;
+    }
+    if (pch_strip && !pch) {
+        std::fprintf(stderr, "Error: --pch-strip needs --pch=FILE\n");
+        return 1;
+    }
+    std::vector<std::string> pch_includes;
+    int exit_code = 0;
+    int stale_files = 0;
+    if (pch) {
+        std::string text;
+        plan_pch(inputs, pch_min, pch, pch_includes, text);
+        if (check) {
+            if (compare_text_file(pch, text) != 0) {
+                std::fprintf(stderr, "Stale %s\n", pch);
+                ++stale_files;
+                exit_code = 1;
+            }
+        }
+        else if (!write_text_file(pch, text)) {
+            std::fprintf(stderr, "Error: cannot write: %s\n", pch);
+            return 1;
+        }
+        else
+            std::fprintf(stderr, "Wrote %s (%d shared include(s))\n", pch,
+                (int)pch_includes.size());
+    }
+    OutputOptions opt;
+    opt.check = check;
+    opt.line_map = line_map;
+    opt.strip_includes = pch && pch_strip ? &pch_includes : 0;
+    opt.packer = pack ? &packer : 0;
+    opt.pack = pack;
+
+    if (jobs > 1) {
+        if (convert_batch(inputs, dialect, opt, jobs, max_mem, stale_files))
+            exit_code = 1;
+    }
+    else
+        for (size_t fi = 0; fi < inputs.size(); ++fi) {
+            FileProfile* prof = 0;
+            if (profile_top || mem_stats) {
+                profiles.push_back(FileProfile());
+                prof = &profiles.back();
+            }
+            FileResult r =
+                convert_file(inputs[fi], dialect, known_types, opt, prof);
+            if (r == FileStale) ++stale_files;
+            if (r != FileOk) exit_code = 1;
+        }
+
+    if (pack) {
+        if (packer.finish())
+            std::fprintf(stderr, "Wrote %s\n", pack);
+        else {
+            std::fprintf(stderr, "Error: cannot write: %s\n", pack);
+            exit_code = 1;
+        }
     }
 
+    if (check)
+        std::fprintf(stderr, "check: %d of %d file(s) stale\n", stale_files,
+            (int)inputs.size() + (pch ? 1 : 0));
+    if (profile_top) print_profile_report(profiles, profile_top);
+    if (mem_stats) print_mem_report(profiles);
     return exit_code;
 }
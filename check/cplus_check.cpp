@@ -0,0 +1,1050 @@
+// C+ converter self-checks, built as a program of their own so that none of
+// this code ships in the converter:
+//
+//   g++ -std=c++98 -O2 -o cplus2cpp-check check/cplus_check.cpp
+//
+// The converter is #included as a library (CPLUS_NO_MAIN); every mode runs
+// on a generated sample corpus plus any files given after it (only those
+// files, for --alloc-check and --incremental-check), and exits 1 on a
+// failure.
+//
+// --diff-reference  the main engine against the frozen baseline converter
+//                   (check/reference.cpp), plus fixtures for behavior
+//                   added since
+// --token-check     convert_tokens() on a lexed stream against the text
+//                   conversion
+// --stream-check    a StreamConverter fed in chunks against the whole-file
+//                   conversion
+// --alloc-check     heap allocations per hot phase against fixed bounds
+// --incremental-check
+//                   IncrementalDoc edits against from-scratch conversions
+// --round-trip-check
+//                   C turned into C+ (--to-cplus) and converted back
+
+#define CPLUS_NO_MAIN
+#define CPLUS_CHECK_PROGRAM
+#define CPLUS_ALLOC_HOOKS  // for --alloc-check; this program is ours
+#include "../C+.cpp"
+
+// ----- reference engine -----
+// check/reference.cpp is the converter as first committed, byte for byte;
+// it is never edited, so a bug in the main engine cannot leak into the
+// oracle. Its headers are included first, which makes its own #includes
+// inside the namespace no-ops, and its main() is renamed.
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace reference {
+#define main baseline_main
+#include "reference.cpp"
+#undef main
+
+// The baseline main()'s per-file pipeline, without the file I/O.
+static void convert(const std::string& src,
+    std::set<std::string>& known_types, std::string& out) {
+    std::string pre = preprocess_physical_lines(src);
+    std::vector<Token> toks;
+    lex(pre, toks);
+
+    std::vector<Scope> scopes;
+    std::vector<std::map<std::string, VarInfo> > scope_vars;
+    analyze_scopes_and_vars(toks, scopes, scope_vars, known_types);
+
+    remove_semicolons_inside_enums(toks, scopes);
+    add_semicolon_after_type_blocks(toks, scopes);
+
+    std::vector<std::vector<Token> > lines;
+    std::vector<int> line_scope;
+    split_into_lines(toks, lines, line_scope);
+
+    std::ostringstream outcpp;
+    for (size_t li = 0; li < lines.size(); ++li) {
+        std::vector<Token>& line = lines[li];
+        int sid = (li < line_scope.size() ? line_scope[li] : 0);
+        rewrite_member_chains(line, sid, scopes, scope_vars);
+        const std::string& kind =
+            (sid < (int)scopes.size() ? scopes[sid].kind
+                : std::string("Global"));
+        insert_semicolon_before_closing_brace_on_line(line, kind);
+        if (!line.empty() && needs_semicolon(line, kind)) {
+            Token semi;
+            semi.type = Token::Punct;
+            semi.text = ";";
+            semi.line = line.back().line;
+            semi.col = line.back().col + 1;
+            line.push_back(semi);
+        }
+        emit_line(line, outcpp);
+    }
+    out = outcpp.str();
+}
+
+}  // namespace reference
+
+// ----- sample corpus -----
+// Deterministic generated C+ sources, one per file class, run by every
+// mode below. Order matters: records come first so their type names are
+// known to the later classes.
+struct SampleFile {
+    std::string name;  // "sample:<class>"
+    std::string text;
+};
+
+static void make_sample_corpus(int units, std::vector<SampleFile>& out) {
+    out.clear();
+    out.resize(5);
+    out[0].name = "sample:records";
+    out[1].name = "sample:pointers";
+    out[2].name = "sample:tables";
+    out[3].name = "sample:directives";
+    out[4].name = "sample:conditionals";
+    unsigned long rng = 12345;
+    for (int u = 0; u < units; ++u) {
+        std::string& r = out[0].text;
+        r += "typedef struct Record_";
+        append_num(r, u);
+        r += " { int id; struct Record_";
+        append_num(r, u);
+        r += "* next; } Record_";
+        append_num(r, u);
+        r += "\nstruct Node_";
+        append_num(r, u);
+        r += " {\n    int value\n    struct Node_";
+        append_num(r, u);
+        r += "* next\n    Record_";
+        append_num(r, u);
+        r += "** slot\n}\nenum Kind_";
+        append_num(r, u);
+        r += " { KIND_A, KIND_B = 2, KIND_C }\n\n";
+
+        std::string& p = out[1].text;
+        p += "int walk_";
+        append_num(p, u);
+        p += "(struct Node_";
+        append_num(p, u);
+        p += "* head, Record_";
+        append_num(p, u);
+        p += "** pr, Record_";
+        append_num(p, u);
+        p += "* items[8], int n) {\n"
+            "    struct Node_";
+        append_num(p, u);
+        p += "* cur = head\n"
+            "    int total = 0\n"
+            "    while (cur) {\n"
+            "        total += cur.value\n"
+            "        cur = cur.next\n"
+            "    }\n"
+            "    pr.id = total\n"
+            "    items[3].id = n\n"
+            "    if (total > n) {\n"
+            "        head.next.value = total\n"
+            "    } else total = n\n"
+            "    for (int i = 0; i < n; ++i)\n"
+            "        total += items[i].id\n"
+            "    return total\n"
+            "}\n\n";
+
+        std::string& t = out[2].text;
+        t += "static const int lookup_table_";
+        append_num(t, u);
+        t += "[] = {\n";
+        for (int row = 0; row < 16; ++row) {
+            t += "   ";
+            for (int col = 0; col < 8; ++col) {
+                rng = rng * 1103515245UL + 12345UL;
+                t += ' ';
+                append_num(t, (long)((rng >> 8) % 100000));
+                t += ',';
+            }
+            t += '\n';
+        }
+        t += "    { 1, 2 }, { 3, 4 }\n}\n\n";
+
+        std::string& d = out[3].text;
+        d += "#include <stdio.h>\n#define CONFIGURATION_BUFFER_LENGTH_";
+        append_num(d, u);
+        d += " 4096\n#if defined(CONFIGURATION_ENABLE_VERBOSE_LOGGING)\n"
+            "#endif\n"
+            "static const char* message_catalog_entry_";
+        append_num(d, u);
+        d += " = \"a string literal too long for any small-string buffer\"\n"
+            "int configuration_option_value_";
+        append_num(d, u);
+        d += " = CONFIGURATION_BUFFER_LENGTH_";
+        append_num(d, u);
+        d += "\n\n";
+
+        std::string& c = out[4].text;
+        c += "#if 0\n"
+            "int disabled_option.value = unconverted_expression\n"
+            "#endif\n"
+            "#if 1\n"
+            "int enabled_flag_";
+        append_num(c, u);
+        c += " = 1\n"
+            "#else\n"
+            "int fallback_flag.value = 2\n"
+            "#endif\n"
+            "#ifdef CONFIGURATION_ENABLE_VERBOSE_LOGGING\n"
+            "int verbose_level_";
+        append_num(c, u);
+        c += " = 3\n#endif\n\n";
+    }
+}
+
+// ----- corpus and timing -----
+// The sample corpus ('units' per class, none if 0) followed by 'inputs'.
+// False, after saying so, if an input cannot be read.
+static bool load_check_corpus(const std::vector<const char*>& inputs,
+    int units, std::vector<SampleFile>& files) {
+    files.clear();
+    if (units > 0) make_sample_corpus(units, files);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        files.push_back(SampleFile());
+        files.back().name = inputs[i];
+        if (!read_file(inputs[i], files.back().text)) {
+            std::fprintf(stderr, "Error: cannot read: %s\n", inputs[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Timed runs per conversion; the best one counts.
+static const int kDiffRuns = 5;
+
+// Best time in ns of 'runs' calls of fn.run(), each after an untimed
+// fn.prepare() that restores its inputs (known_types snapshots).
+template <class Fn>
+static double best_of(int runs, Fn fn) {
+    double best = -1;
+    for (int r = 0; r < runs; ++r) {
+        fn.prepare();
+        double t0 = now_ns();
+        fn.run();
+        double dt = now_ns() - t0;
+        if (best < 0 || dt < best) best = dt;
+    }
+    return best;
+}
+
+// A text conversion through 'dialect', from a known_types snapshot.
+struct TextRun {
+    const DialectEntry* dialect;
+    const std::string* src;
+    const std::set<std::string>* types;
+    std::set<std::string> kt;
+    std::string out;
+    TextRun(const DialectEntry* d, const std::string& s,
+        const std::set<std::string>& t)
+        : dialect(d), src(&s), types(&t) {}
+    void prepare() {
+        kt = *types;
+        std::string().swap(out);
+    }
+    void run() { dialect->convert(*src, kt, out, 0, 0); }
+};
+
+// The same through the frozen baseline.
+struct ReferenceRun {
+    const std::string* src;
+    const std::set<std::string>* types;
+    std::set<std::string> kt;
+    std::string out;
+    ReferenceRun(const std::string& s, const std::set<std::string>& t)
+        : src(&s), types(&t) {}
+    void prepare() {
+        kt = *types;
+        std::string().swap(out);
+    }
+    void run() { reference::convert(*src, kt, out); }
+};
+
+// The same from a token stream, through the full dialect.
+struct TokenRun {
+    const TokenStream* stream;
+    const std::set<std::string>* types;
+    std::set<std::string> kt;
+    std::string out;
+    TokenRun(const TokenStream& s, const std::set<std::string>& t)
+        : stream(&s), types(&t) {}
+    void prepare() {
+        kt = *types;
+        std::string().swap(out);
+    }
+    void run() { kDialects[0].convert_tokens(*stream, kt, out, 0); }
+};
+
+// The first line where 'got' differs from 'want', both shown.
+static void print_first_difference(const char* mode, const std::string& name,
+    const std::string& want, const std::string& got) {
+    size_t pos = 0, line = 1, bol = 0;
+    while (pos < want.size() && pos < got.size() && want[pos] == got[pos]) {
+        if (want[pos] == '\n') {
+            ++line;
+            bol = pos + 1;
+        }
+        ++pos;
+    }
+    size_t we = want.find('\n', bol), ge = got.find('\n', bol);
+    if (we == std::string::npos) we = want.size();
+    if (ge == std::string::npos) ge = got.size();
+    std::fprintf(stderr, "%s: %s: MISMATCH at line %lu\n", mode,
+        name.c_str(), (unsigned long)line);
+    std::fprintf(stderr, "  reference: %.*s\n", (int)(we - bol),
+        want.data() + bol);
+    std::fprintf(stderr, "  optimized: %.*s\n", (int)(ge - bol),
+        got.data() + bol);
+}
+
+// Each sample class times on its own; the files given on the command line
+// share one class.
+static std::string file_class(const std::string& name) {
+    return name.compare(0, 7, "sample:") == 0 ? name : std::string("inputs");
+}
+
+// Summed times of two engines per file class (file_class()), printed as a
+// table with the second engine's speedup over the first.
+struct ClassTimes {
+    std::vector<std::string> order;  // classes, first seen first
+    std::map<std::string, double> a_ns, b_ns;
+
+    void add(const std::string& name, double a, double b) {
+        std::string cls = file_class(name);
+        if (!a_ns.count(cls)) order.push_back(cls);
+        a_ns[cls] += a;
+        b_ns[cls] += b;
+    }
+
+    void print(const char* mode, const char* a, const char* b) {
+        std::fprintf(stderr, "%s: %-20s %12s %12s %8s\n", mode, "class", a,
+            b, "speedup");
+        for (size_t i = 0; i < order.size(); ++i) {
+            double x = a_ns[order[i]], y = b_ns[order[i]];
+            std::fprintf(stderr, "%s: %-20s %10.3fms %10.3fms %7.2fx\n",
+                mode, order[i].c_str(), x / 1e6, y / 1e6,
+                y > 0 ? x / y : 0.0);
+        }
+    }
+};
+
+// ----- differential check -----
+// --diff-reference converts every input with both engines, requires the
+// outputs to be byte-identical, and reports how much faster the main engine
+// is per file class. Each engine keeps its own known_types so a divergence in
+// one file cannot mask or cause one in the next.
+// Behavior added after the baseline differs from it on purpose: initializer
+// bodies are one flat scope with a single ';' after the '}', and #if
+// branches that are certainly not taken are copied verbatim. Sample classes
+// built on those are left to the fixtures, which hold the main engine to
+// fixed outputs instead.
+
+// Sample classes the baseline converts differently, on purpose.
+static bool newer_than_baseline(const std::string& name) {
+    return name == "sample:tables" || name == "sample:conditionals";
+}
+
+struct Fixture {
+    const char* name;
+    const char* define;  // -D for this fixture (NAME or NAME=VALUE), or 0
+    const char* input;
+    const char* want;
+};
+
+static const Fixture kFixtures[] = {
+    { "initializer-rows", 0,
+        "struct Pair { int a; int b; }\n"
+        "static const struct Pair pairs[] = {\n"
+        "    { 1, 2 },\n"
+        "    { 3, 4 }\n"
+        "}\n"
+        "int count = 2\n",
+        "struct Pair { int a; int b; };\n"
+        "static const struct Pair pairs [] = {\n"
+        "{ 1, 2 },\n"
+        "{ 3, 4 }\n"
+        "};\n"
+        "int count = 2;\n" },
+    { "initializer-inline", 0,
+        "int xs[] = { 1, 2, 3 }\n"
+        "int* p = xs\n"
+        "int f(struct Pair* q) {\n"
+        "    struct Pair r = { q.a, q.b }\n"
+        "    return r.a\n"
+        "}\n",
+        "int xs [] = { 1, 2, 3 };\n"
+        "int * p = xs;\n"
+        "int f ( struct Pair * q) {\n"
+        "struct Pair r = { q -> a, q -> b };\n"
+        "return r . a;\n"
+        "};\n" },
+    { "if-0", 0,
+        "int a = 1\n"
+        "#if 0\n"
+        "int b.c = d\n"
+        "#endif\n"
+        "int e = 2\n",
+        "int a = 1;\n"
+        "#if 0\n"
+        "int b.c = d\n"
+        "#endif\n"
+        "int e = 2;\n" },
+    { "if-1-else", 0,
+        "#if 1\n"
+        "int on = 1\n"
+        "#else\n"
+        "int off.x = 2\n"
+        "#endif\n",
+        "#if 1\n"
+        "int on = 1;\n"
+        "#else\n"
+        "int off.x = 2\n"
+        "#endif\n" },
+    { "ifdef-defined", "FAST",
+        "#ifdef FAST\n"
+        "int fast = 1\n"
+        "#else\n"
+        "int slow.x = 2\n"
+        "#endif\n"
+        "#if defined(OTHER)\n"
+        "int other.y = 3\n"
+        "#endif\n",
+        "#ifdef FAST\n"
+        "int fast = 1;\n"
+        "#else\n"
+        "int slow.x = 2\n"
+        "#endif\n"
+        "#if defined(OTHER)\n"
+        "int other . y = 3;\n"
+        "#endif\n" },
+};
+
+// Every fixture through the full dialect; true if all match.
+static bool check_fixtures() {
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(kFixtures) / sizeof(kFixtures[0]); ++i) {
+        const Fixture& fx = kFixtures[i];
+        MacroDefs saved = g_macros;
+        if (fx.define) {
+            const char* eq = std::strchr(fx.define, '=');
+            g_macros.defined[eq ? std::string(fx.define, eq) : fx.define] =
+                eq ? eq + 1 : "";
+        }
+        std::set<std::string> kt = builtin_types();
+        std::string got;
+        kDialects[0].convert(fx.input, kt, got, 0, 0);
+        g_macros = saved;
+        std::string name = std::string("fixture:") + fx.name;
+        if (got != fx.want) {
+            print_first_difference("diff-reference", name, fx.want, got);
+            ok = false;
+        }
+    }
+    std::fprintf(stderr, "diff-reference: %lu fixture(s) %s\n",
+        (unsigned long)(sizeof(kFixtures) / sizeof(kFixtures[0])),
+        ok ? "matched" : "DIFFER");
+    return ok;
+}
+
+// Returns the process exit code: 0 when both engines agree on every input
+// and every fixture matches.
+static int diff_reference(const std::vector<const char*>& inputs) {
+    std::vector<SampleFile> files;
+    if (!load_check_corpus(inputs, 200, files)) return 1;
+
+    std::set<std::string> ref_types = reference::builtin_types();
+    std::set<std::string> opt_types = builtin_types();
+    ClassTimes times;
+    size_t compared = 0;
+    bool ok = true;
+    for (size_t i = 0; i < files.size(); ++i) {
+        const SampleFile& f = files[i];
+        if (newer_than_baseline(f.name)) continue;
+        double rt = best_of(kDiffRuns, ReferenceRun(f.text, ref_types));
+        double ot =
+            best_of(kDiffRuns, TextRun(&kDialects[0], f.text, opt_types));
+
+        std::string want, got;
+        reference::convert(f.text, ref_types, want);
+        kDialects[0].convert(f.text, opt_types, got, 0, 0);
+        if (want != got) {
+            print_first_difference("diff-reference", f.name, want, got);
+            ok = false;
+        }
+        times.add(f.name, rt, ot);
+        ++compared;
+    }
+
+    times.print("diff-reference", "reference", "optimized");
+    std::fprintf(stderr, "diff-reference: %lu file(s) %s\n",
+        (unsigned long)compared, ok ? "identical" : "DIFFER");
+    ok = check_fixtures() && ok;
+    return ok ? 0 : 1;
+}
+
+// ----- token-stream check -----
+// --token-check re-feeds every input to convert_tokens() as the stream a
+// generator would build (lexed tokens, interned, with their line breaks)
+// and requires the output to equal the text conversion. It reports both
+// timings; the text side includes preprocessing and lexing, the token side
+// does not, which is the saving a generator gets. An input the full
+// dialect rejects ('->') is reported and skipped; it has no stream.
+static bool stream_from_text(const std::string& pre, TokenStream& s,
+    LexError& err) {
+    std::vector<Token> toks;
+    std::vector<LineSummary> summaries;
+    std::vector<LexError> errors;
+    lex(pre, toks, summaries, true, 0, 0, &errors);
+    if (!errors.empty()) {
+        err = errors[0];
+        return false;
+    }
+    LineIndex index;
+    index.build(pre);
+    s.clear();
+    int line = 1;
+    for (size_t i = 0; i < toks.size(); ++i) {
+        for (int l = index.line_of(toks[i].pos); line < l; ++line)
+            s.newline();
+        s.push(toks[i].type, toks[i].text);
+        line = index.line_of(token_last(toks[i]));
+    }
+    return true;
+}
+
+// Returns the process exit code: 0 when both inputs agree on every file.
+static int token_check(const std::vector<const char*>& inputs) {
+    std::vector<SampleFile> files;
+    if (!load_check_corpus(inputs, 200, files)) return 1;
+
+    std::set<std::string> text_types = builtin_types();
+    std::set<std::string> tok_types = builtin_types();
+    ClassTimes times;
+    bool ok = true;
+    TokenStream s;
+    for (size_t i = 0; i < files.size(); ++i) {
+        const SampleFile& f = files[i];
+        LexError err;
+        if (!stream_from_text(preprocess_physical_lines(f.text), s, err)) {
+            std::fprintf(stderr, "token-check: %s: %d:%d: %s\n",
+                f.name.c_str(), err.line, err.col, err.message);
+            ok = false;
+            continue;
+        }
+        double tt =
+            best_of(kDiffRuns, TextRun(&kDialects[0], f.text, text_types));
+        double st = best_of(kDiffRuns, TokenRun(s, tok_types));
+
+        std::string want, got;
+        kDialects[0].convert(f.text, text_types, want, 0, 0);
+        if (!kDialects[0].convert_tokens(s, tok_types, got, &err)) {
+            std::fprintf(stderr, "token-check: %s: %d:%d: %s\n",
+                f.name.c_str(), err.line, err.col, err.message);
+            ok = false;
+        }
+        else if (want != got) {
+            print_first_difference("token-check", f.name, want, got);
+            ok = false;
+        }
+        times.add(f.name, tt, st);
+    }
+
+    times.print("token-check", "text", "tokens");
+    std::fprintf(stderr, "token-check: %lu file(s) %s\n",
+        (unsigned long)files.size(), ok ? "identical" : "DIFFER");
+    return ok ? 0 : 1;
+}
+
+// ----- stream check -----
+// --stream-check feeds every input to a StreamConverter in chunks of
+// several sizes (down to one byte, so every cut and every split construct
+// is exercised) and requires the joined output to equal the whole-file
+// conversion. It times the largest chunk size against the whole file and
+// reports the most input held at once. An input the full dialect rejects
+// ('->') is reported and skipped.
+static const size_t kStreamChunks[] = { 1, 61, 4096 };
+
+static bool stream_in_chunks(const std::string& text, size_t chunk,
+    std::set<std::string>& known_types, std::string& out, size_t& peak,
+    LexError& err) {
+    StreamConverter sc(&kDialects[0], known_types);
+    out.clear();
+    for (size_t at = 0; at < text.size(); at += chunk)
+        if (!sc.feed(text.data() + at, std::min(chunk, text.size() - at),
+                out)) {
+            err = sc.error();
+            return false;
+        }
+    bool ok = sc.finish(out);
+    err = sc.error();
+    peak = sc.peak_buffered();
+    return ok;
+}
+
+// A streamed conversion in 'chunk'-byte pieces, for best_of().
+struct StreamRun {
+    const std::string* src;
+    size_t chunk;
+    const std::set<std::string>* types;
+    std::set<std::string> kt;
+    std::string out;
+    StreamRun(const std::string& s, size_t c, const std::set<std::string>& t)
+        : src(&s), chunk(c), types(&t) {}
+    void prepare() {
+        kt = *types;
+        std::string().swap(out);
+    }
+    void run() {
+        size_t peak = 0;
+        LexError err;
+        stream_in_chunks(*src, chunk, kt, out, peak, err);
+    }
+};
+
+// Returns the process exit code: 0 when every chunking agrees on every file.
+static int stream_check(const std::vector<const char*>& inputs) {
+    std::vector<SampleFile> files;
+    if (!load_check_corpus(inputs, 200, files)) return 1;
+
+    const size_t nchunks = sizeof(kStreamChunks) / sizeof(kStreamChunks[0]);
+    const size_t timed = kStreamChunks[nchunks - 1];
+    std::set<std::string> text_types = builtin_types();
+    std::vector<std::set<std::string> > stream_types(nchunks, text_types);
+    size_t total = 0, largest = 0, largest_peak = 0;
+    ClassTimes times;
+    bool ok = true;
+    for (size_t i = 0; i < files.size(); ++i) {
+        const SampleFile& f = files[i];
+        // the whole-file conversion exits on '->'; the stream reports it
+        std::set<std::string> probe_types = stream_types[nchunks - 1];
+        std::string probe;
+        size_t probe_peak = 0;
+        LexError probe_err;
+        if (!stream_in_chunks(f.text, timed, probe_types, probe, probe_peak,
+                probe_err)) {
+            std::fprintf(stderr, "stream-check: %s: %d:%d: %s\n",
+                f.name.c_str(), probe_err.line, probe_err.col,
+                probe_err.message);
+            ok = false;
+            continue;
+        }
+        double tt =
+            best_of(kDiffRuns, TextRun(&kDialects[0], f.text, text_types));
+        double st = best_of(kDiffRuns,
+            StreamRun(f.text, timed, stream_types[nchunks - 1]));
+        std::string want;
+        kDialects[0].convert(f.text, text_types, want, 0, 0);
+        for (size_t c = 0; c < nchunks; ++c) {
+            std::string got;
+            size_t peak = 0;
+            LexError err;
+            if (!stream_in_chunks(f.text, kStreamChunks[c], stream_types[c],
+                    got, peak, err)) {
+                std::fprintf(stderr, "stream-check: %s: %d:%d: %s\n",
+                    f.name.c_str(), err.line, err.col, err.message);
+                ok = false;
+                break;
+            }
+            if (want != got) {
+                char mode[48];
+                std::sprintf(mode, "stream-check (%lu-byte chunks)",
+                    (unsigned long)kStreamChunks[c]);
+                print_first_difference(mode, f.name, want, got);
+                ok = false;
+                break;
+            }
+            if (c == nchunks - 1 && f.text.size() >= largest) {
+                largest = f.text.size();
+                largest_peak = peak;
+            }
+        }
+        times.add(f.name, tt, st);
+        total += f.text.size();
+    }
+
+    char label[32];
+    std::sprintf(label, "%lu-byte", (unsigned long)timed);
+    times.print("stream-check", "whole-file", label);
+    std::fprintf(stderr,
+        "stream-check: largest input %lu bytes, at most %lu buffered\n",
+        (unsigned long)largest, (unsigned long)largest_peak);
+    std::fprintf(stderr, "stream-check: %lu file(s), %lu bytes %s\n",
+        (unsigned long)files.size(), (unsigned long)total,
+        ok ? "identical" : "DIFFER");
+    return ok ? 0 : 1;
+}
+
+// ----- round-trip check -----
+// --round-trip-check: the sample corpus (converted to C++ first) and every
+// input go through to_cplus in memory; reports the forward throughput on
+// the resulting C+ and fails if any file is lossy.
+static int round_trip_check(const std::vector<const char*>& inputs,
+    const DialectEntry* dialect) {
+    std::vector<SampleFile> files;
+    if (!load_check_corpus(inputs, 200, files)) return 1;
+    std::set<std::string> sample_types = builtin_types();
+    for (size_t i = 0; i + inputs.size() < files.size(); ++i) {
+        std::string out;
+        kDialects[0].convert(files[i].text, sample_types, out, 0, 0);
+        files[i].text.swap(out);
+    }
+
+    std::set<std::string> known_types = builtin_types();
+    bool lossless = true;
+    double bytes = 0, ns = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::set<std::string> before = known_types;
+        ReverseResult r;
+        to_cplus(files[i].text, dialect, known_types, r);
+        print_reverse_result("round-trip", files[i].name, r);
+        if (r.lossy_line) lossless = false;
+        bytes += (double)r.cplus.size();
+        ns += best_of(kDiffRuns, TextRun(dialect, r.cplus, before));
+    }
+    std::fprintf(stderr, "round-trip: %lu file(s), %.0f bytes of C+ "
+        "converted in %.3f ms (%.1f MB/s), %s\n",
+        (unsigned long)files.size(), bytes, ns / 1e6,
+        ns > 0 ? bytes / (ns / 1e3) : 0.0,
+        lossless ? "lossless" : "LOSSY");
+    return lossless ? 0 : 1;
+}
+
+// ----- allocation check -----
+// --alloc-check runs each hot phase with allocation counting on and holds the
+// count per token (lex, analyze) or per line (rewrite, emit) to a fixed
+// bound. On a miss it prints the call chains that allocated. The counting
+// allocator is always on in this program.
+struct AllocBound {
+    const char* phase;
+    const char* unit;
+    double per_unit;
+    bool long_text;  // plus one per token text too long for the SSO buffer
+    unsigned long long slack;  // fixed per-file allowance (tables, growth)
+};
+
+enum { kBoundLex, kBoundAnalyze, kBoundRewrite, kBoundEmit };
+static const AllocBound kAllocBounds[] = {
+    { "lex", "token", 0.05, true, 64 },
+    // one map node per declared name is inherent to scope_vars
+    { "analyze_scopes_and_vars", "token", 0.25, true, 64 },
+    { "rewrite_member_chains", "line", 0.05, false, 16 },
+    { "emit_line", "line", 0.01, false, 16 },
+};
+
+static void alloc_phase_begin() {
+    g_alloc.count = 0;
+    g_alloc.bytes = 0;
+#ifdef CPLUS_ALLOC_SITES
+    std::memset(g_sites, 0, sizeof(g_sites));
+    g_site_capture = true;
+#endif
+    g_alloc_counting = true;
+}
+
+static unsigned long long alloc_phase_end() {
+    g_alloc_counting = false;
+#ifdef CPLUS_ALLOC_SITES
+    g_site_capture = false;
+#endif
+    return g_alloc.count;
+}
+
+static void print_alloc_sites() {
+#ifdef CPLUS_ALLOC_SITES
+    for (int rank = 0; rank < 5; ++rank) {
+        int best = -1;
+        for (int k = 0; k < kSiteSlots; ++k)
+            if (g_sites[k].count &&
+                (best < 0 || g_sites[k].count > g_sites[best].count))
+                best = k;
+        if (best < 0) break;
+        std::fprintf(stderr, "    %llu allocation(s) from:\n",
+            g_sites[best].count);
+        std::fflush(stderr);
+        ::backtrace_symbols_fd(g_sites[best].frames, g_sites[best].depth, 2);
+        g_sites[best].count = 0;
+    }
+    std::fprintf(stderr,
+        "    (resolve offsets with: addr2line -f -C -e <binary> <offset>)\n");
+#else
+    std::fprintf(stderr, "    (call sites need glibc backtrace support)\n");
+#endif
+}
+
+static bool check_alloc_bound(int which, const std::string& name,
+    unsigned long long allocs, size_t units, size_t long_texts) {
+    const AllocBound& b = kAllocBounds[which];
+    size_t extra = b.long_text ? long_texts : 0;
+    double limit = (double)(b.slack + extra) + b.per_unit * (double)units;
+    bool ok = (double)allocs <= limit;
+    std::fprintf(stderr,
+        "alloc-check: %-20s %-24s %8llu allocs / %8lu %ss = %.4f "
+        "(bound %.2f/%s + %lu + %llu) %s\n",
+        name.c_str(), b.phase, allocs, (unsigned long)units, b.unit,
+        units ? (double)allocs / (double)units : 0.0, b.per_unit, b.unit,
+        (unsigned long)extra, b.slack, ok ? "ok" : "EXCEEDED");
+    if (!ok) print_alloc_sites();
+    return ok;
+}
+
+static bool alloc_check_source(const std::string& name,
+    const std::string& src, std::set<std::string>& known_types) {
+    bool ok = true;
+    std::string pre = preprocess_physical_lines(src);
+
+    std::vector<Token> toks;
+    std::vector<LineSummary> summaries;
+    std::vector<LexError> errors;
+    alloc_phase_begin();
+    lex(pre, toks, summaries, true, 0, 0, &errors);
+    unsigned long long lex_allocs = alloc_phase_end();
+    if (!errors.empty()) {
+        std::fprintf(stderr, "alloc-check: %s: %d:%d: %s\n", name.c_str(),
+            errors[0].line, errors[0].col, errors[0].message);
+        return false;
+    }
+    LineIndex index;
+    index.build(pre);
+    size_t long_texts = 0;
+    const size_t sso = std::string().capacity();
+    for (size_t i = 0; i < toks.size(); ++i)
+        if (toks[i].text.size() > sso) ++long_texts;
+    ok = check_alloc_bound(kBoundLex, name, lex_allocs, toks.size(),
+        long_texts) && ok;
+
+    std::vector<Scope> scopes;
+    std::vector<std::map<std::string, VarInfo> > scope_vars;
+    alloc_phase_begin();
+    analyze_scopes_and_vars(toks, scopes, scope_vars, known_types, 0);
+    ok = check_alloc_bound(kBoundAnalyze, name, alloc_phase_end(),
+        toks.size(), long_texts) && ok;
+
+    remove_semicolons_inside_enums(toks, scopes);
+    add_semicolon_after_type_blocks(toks, scopes, true, true);
+    std::vector<std::vector<Token> > lines;
+    std::vector<int> line_scope;
+    std::vector<int> line_no;
+    split_into_lines(toks, index, summaries, lines, line_scope, line_no);
+
+    alloc_phase_begin();
+    for (size_t li = 0; li < lines.size(); ++li)
+        rewrite_member_chains(lines[li], line_scope[li], scopes, scope_vars,
+            summaries[line_no[li]]);
+    ok = check_alloc_bound(kBoundRewrite, name, alloc_phase_end(),
+        lines.size(), 0) && ok;
+
+    std::string out;
+    out.reserve(pre.size() + pre.size() / 8);
+    alloc_phase_begin();
+    for (size_t li = 0; li < lines.size(); ++li) emit_line(lines[li], out);
+    ok = check_alloc_bound(kBoundEmit, name, alloc_phase_end(),
+        lines.size(), 0) && ok;
+    return ok;
+}
+
+// Returns the process exit code: 0 when every phase of every input is within
+// its bound.
+static int alloc_check(const std::vector<const char*>& inputs) {
+    std::vector<SampleFile> files;
+    if (!load_check_corpus(inputs, inputs.empty() ? 200 : 0, files))
+        return 1;
+    std::set<std::string> known_types = builtin_types();
+    bool ok = true;
+    for (size_t i = 0; i < files.size(); ++i)
+        ok = alloc_check_source(files[i].name, files[i].text, known_types) &&
+            ok;
+    std::fprintf(stderr, "alloc-check: %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
+// ----- incremental check -----
+// --incremental-check replays a fixed series of edits on each input through
+// IncrementalDoc. After every edit the document's output must equal a
+// from-scratch conversion of the edited text, and the returned hunk applied
+// to the previous output must give the same text.
+static const int kIncrementalEdits = 40;
+
+// Pick the next probe edit on 'text' (deterministic in 'seed').
+static void next_probe_edit(const std::string& text, unsigned& seed,
+    size_t& offset, size_t& removed, std::string& inserted) {
+    std::vector<size_t> starts(1, 0);
+    for (size_t i = text.find('\n'); i != std::string::npos;
+        i = text.find('\n', i + 1))
+        if (i + 1 < text.size()) starts.push_back(i + 1);
+    seed = seed * 1103515245u + 12345u;
+    size_t line = (seed >> 8) % starts.size();
+    seed = seed * 1103515245u + 12345u;
+    int kind = (int)((seed >> 8) % 11);
+    size_t eol = text.find('\n', starts[line]);
+    if (eol == std::string::npos) eol = text.size();
+
+    offset = starts[line];
+    removed = 0;
+    inserted.clear();
+    char tag[16];
+    std::sprintf(tag, "%u", (seed >> 12) % 1000);
+    switch (kind) {
+    case 0:
+        inserted = std::string("    int probe_") + tag + " = 1\n";
+        break;
+    case 1:  // drop the line
+        removed = eol < text.size() ? eol + 1 - offset : eol - offset;
+        break;
+    case 2:
+        inserted = "    probe.x = 2\n";
+        break;
+    case 3:  // whitespace inside the line
+        offset = text.find('.', offset);
+        if (offset == std::string::npos || offset > eol) offset = eol;
+        inserted = " ";
+        break;
+    case 4:
+        inserted = std::string("typedef int probe_t") + tag + "\n";
+        break;
+    case 5:
+        inserted = "    {\n    int* q = 0\n    q.x = 1\n    }\n";
+        break;
+    case 6:  // a lone CR splits the line
+        offset = eol > offset ? offset + 1 : offset;
+        inserted = "\r";
+        break;
+    case 7:  // constructs left open at EOF, then text appended after them
+        offset = text.size();
+        inserted = "/* open\n";
+        break;
+    case 8:
+        offset = text.size();
+        inserted = "#if 0\n";
+        break;
+    case 9:
+        offset = text.size();
+        inserted = (seed >> 4) & 1 ? "\n" : "b\n";
+        break;
+    default:
+        inserted = "/* probe\n*/\n";
+        break;
+    }
+}
+
+// Returns the process exit code: 0 when every edit matched.
+static int incremental_check(const std::vector<const char*>& inputs) {
+    std::vector<SampleFile> files;
+    if (!load_check_corpus(inputs, inputs.empty() ? 20 : 0, files)) return 1;
+
+    std::set<std::string> batch_types = builtin_types();
+    bool ok = true;
+    for (size_t fi = 0; fi < files.size(); ++fi) {
+        const SampleFile& f = files[fi];
+        IncrementalDoc doc;
+        doc.open(f.text, batch_types);
+        std::string prev = doc.output();
+        unsigned seed = 12345u + (unsigned)fi;
+        double fast_ns = 0, slow_ns = 0, full_ns = 0;
+        int edits = 0;
+        for (; edits < kIncrementalEdits; ++edits) {
+            size_t offset, removed;
+            std::string inserted;
+            next_probe_edit(doc.text, seed, offset, removed, inserted);
+            LineDiff diff;
+            double t0 = now_ns();
+            bool fast = doc.edit(offset, removed, inserted, diff);
+            double t1 = now_ns();
+            std::set<std::string> kt = batch_types;
+            std::string want;
+            convert_source<DialectFull>(doc.text, kt, want, 0);
+            full_ns += now_ns() - t1;
+            (fast ? fast_ns : slow_ns) += t1 - t0;
+
+            std::string got = doc.output();
+            std::vector<std::string> patched;
+            split_output_lines(prev, patched);
+            patched.erase(patched.begin() + diff.first,
+                patched.begin() + diff.first + diff.removed);
+            patched.insert(patched.begin() + diff.first, diff.lines.begin(),
+                diff.lines.end());
+            std::string applied;
+            for (size_t k = 0; k < patched.size(); ++k) {
+                applied += patched[k];
+                applied += '\n';
+            }
+            if (got != want || applied != want) {
+                std::fprintf(stderr,
+                    "incremental-check: %s: edit %d at byte %lu\n",
+                    f.name.c_str(), edits + 1, (unsigned long)offset);
+                print_first_difference("incremental-check", f.name, want,
+                    got != want ? got : applied);
+                ok = false;
+                break;
+            }
+            prev.swap(got);
+        }
+        int fast = doc.partial_edits, slow = doc.full_rebuilds;
+        std::fprintf(stderr,
+            "incremental-check: %-20s %3d edits: %2d incremental %8.3f ms, "
+            "%2d full %8.3f ms; conversion %8.3f ms\n",
+            f.name.c_str(), edits, fast, fast ? fast_ns / fast / 1e6 : 0.0,
+            slow, slow ? slow_ns / slow / 1e6 : 0.0,
+            edits ? full_ns / edits / 1e6 : 0.0);
+        std::string out;
+        convert_source<DialectFull>(f.text, batch_types, out, 0);
+    }
+    std::fprintf(stderr, "incremental-check: %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+static void print_check_usage(const char* argv0) {
+    std::fprintf(stderr,
+        "Usage: %s --diff-reference [file.cp ...]\n"
+        "       %s --token-check [file.cp ...]\n"
+        "       %s --stream-check [file.cp ...]\n"
+        "       %s [--dialect=NAME] --round-trip-check [file.c ...]\n"
+        "       %s --alloc-check [file.cp ...]\n"
+        "       %s --incremental-check [file.cp ...]\n",
+        argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+int main(int argc, char** argv) {
+    const char* mode = 0;
+    const DialectEntry* dialect = 0;
+    std::vector<const char*> inputs;
+    for (int ai = 1; ai < argc; ++ai) {
+        const char* arg = argv[ai];
+        if (arg[0] != '-' || arg[1] != '-')
+            inputs.push_back(arg);
+        else if (std::strncmp(arg, "--dialect=", 10) == 0) {
+            dialect = find_dialect(arg + 10);
+            if (!dialect) {
+                std::fprintf(stderr, "Error: unknown dialect: %s\n",
+                    arg + 10);
+                return 1;
+            }
+        }
+        else if (!mode)
+            mode = arg;
+        else {
+            std::fprintf(stderr, "Error: one mode at a time: %s\n", arg);
+            return 1;
+        }
+    }
+    if (mode && std::strcmp(mode, "--round-trip-check") == 0)
+        return round_trip_check(inputs, dialect ? dialect : &kDialects[0]);
+    if (dialect) {
+        std::fprintf(stderr,
+            "Error: --dialect applies to --round-trip-check only\n");
+        return 1;
+    }
+    if (mode && std::strcmp(mode, "--diff-reference") == 0)
+        return diff_reference(inputs);
+    if (mode && std::strcmp(mode, "--token-check") == 0)
+        return token_check(inputs);
+    if (mode && std::strcmp(mode, "--stream-check") == 0)
+        return stream_check(inputs);
+    if (mode && std::strcmp(mode, "--alloc-check") == 0)
+        return alloc_check(inputs);
+    if (mode && std::strcmp(mode, "--incremental-check") == 0)
+        return incremental_check(inputs);
+    if (mode) std::fprintf(stderr, "Error: unknown mode: %s\n", mode);
+    print_check_usage(argv[0]);
+    return 1;
+}